@@ -0,0 +1,167 @@
+#include "BarnesHut.h"
+
+namespace rme
+{
+
+	BarnesHut::BarnesHut(float t)
+	{
+		theta = t;
+		leafSize = 8;
+	}
+
+	void BarnesHut::build(const glm::vec3* p, const float* q, int count)
+	{
+		nodes.clear();
+		positions.assign(p, p + count);
+		charges.assign(q, q + count);
+		order.resize(count);
+		octants.resize(count);
+		sorted.resize(count);
+		if (count == 0) return;
+
+		glm::vec3 lo = p[0], hi = p[0];
+		for (int i = 0; i < count; i++)
+		{
+			order[i] = i;
+			lo = glm::min(lo, p[i]);
+			hi = glm::max(hi, p[i]);
+		}
+		glm::vec3 extent = hi - lo;
+
+		Node root;
+		root.boxCenter = 0.5f*(lo + hi);
+		root.halfSize = 0.5f*glm::max(extent.x, glm::max(extent.y, extent.z)) + 0.001f;
+		root.firstChild = -1;
+		root.childCount = 0;
+		root.begin = 0;
+		root.end = count;
+		nodes.push_back(root);
+		split(0, 0);
+	}
+
+	void BarnesHut::split(int index, int depth)
+	{
+		Node node = nodes[index];
+
+		// Monopole moments
+		float netCharge = 0.0f;
+		float absCharge = 0.0f;
+		glm::vec3 weighted = glm::vec3(0.0f);
+		for (int i = node.begin; i < node.end; i++)
+		{
+			int body = order[i];
+			float w = glm::abs(charges[body]);
+			netCharge += charges[body];
+			absCharge += w;
+			weighted += w*positions[body];
+		}
+		node.charge = netCharge;
+		node.absCharge = absCharge;
+		node.center = absCharge > 0.0f ? weighted / absCharge : node.boxCenter;
+
+		// Coincident bodies can never be separated, so depth is capped
+		if (node.end - node.begin <= leafSize || depth >= 20)
+		{
+			nodes[index] = node;
+			return;
+		}
+
+		// Counting sort of the bodies into octants
+		int counts[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		for (int i = node.begin; i < node.end; i++)
+		{
+			glm::vec3 d = positions[order[i]] - node.boxCenter;
+			int o = (d.x >= 0.0f ? 1 : 0) | (d.y >= 0.0f ? 2 : 0) | (d.z >= 0.0f ? 4 : 0);
+			octants[i] = o;
+			counts[o]++;
+		}
+		int starts[8];
+		int offset = node.begin;
+		for (int o = 0; o < 8; o++)
+		{
+			starts[o] = offset;
+			offset += counts[o];
+		}
+		int fill[8];
+		for (int o = 0; o < 8; o++) fill[o] = starts[o];
+		for (int i = node.begin; i < node.end; i++)
+		{
+			sorted[fill[octants[i]]++] = order[i];
+		}
+		for (int i = node.begin; i < node.end; i++) order[i] = sorted[i];
+
+		node.firstChild = nodes.size();
+		node.childCount = 0;
+		float half = 0.5f*node.halfSize;
+		for (int o = 0; o < 8; o++)
+		{
+			if (counts[o] == 0) continue;
+			Node child;
+			child.boxCenter = node.boxCenter + glm::vec3(o & 1 ? half : -half, o & 2 ? half : -half, o & 4 ? half : -half);
+			child.halfSize = half;
+			child.firstChild = -1;
+			child.childCount = 0;
+			child.begin = starts[o];
+			child.end = starts[o] + counts[o];
+			nodes.push_back(child);
+			node.childCount++;
+		}
+		nodes[index] = node;
+		for (int c = 0; c < node.childCount; c++)
+		{
+			split(node.firstChild + c, depth + 1);
+		}
+	}
+
+	int BarnesHut::body(int k)
+	{
+		return order[k];
+	}
+
+	glm::vec3 BarnesHut::field(glm::vec3 p, int self)
+	{
+		glm::vec3 e = glm::vec3(0.0f);
+		if (nodes.empty()) return e;
+
+		int stack[256];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const Node &node = nodes[stack[--top]];
+			if (node.absCharge == 0.0f) continue;
+
+			glm::vec3 diff = p - node.center;
+			float dist2 = glm::dot(diff, diff);
+			glm::vec3 offset = glm::abs(p - node.boxCenter);
+			bool inside = offset.x <= node.halfSize && offset.y <= node.halfSize && offset.z <= node.halfSize;
+			float size = 2.0f*node.halfSize;
+
+			// Far enough away to use the monopole
+			if (!inside && size*size < theta*theta*dist2)
+			{
+				e += diff * (node.charge / dist2);
+				continue;
+			}
+
+			if (node.firstChild < 0)
+			{
+				for (int i = node.begin; i < node.end; i++)
+				{
+					int body = order[i];
+					if (body == self) continue;
+					glm::vec3 d = p - positions[body];
+					e += d * (charges[body] / glm::dot(d, d));
+				}
+				continue;
+			}
+
+			for (int c = 0; c < node.childCount; c++)
+			{
+				stack[top++] = node.firstChild + c;
+			}
+		}
+		return e;
+	}
+
+}
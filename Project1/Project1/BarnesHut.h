@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <glm.hpp>
+
+namespace rme
+{
+
+	enum ForceSolver
+	{
+		FORCE_EXACT,
+		FORCE_BARNES_HUT
+	};
+
+	struct ForceStats
+	{
+		int bodies;
+		double buildTime; // seconds, octree construction
+		double solveTime; // seconds, force evaluation
+		// Relative to the exact sum, filled in by Scene::measureForceError
+		float rmsError;
+		float maxError;
+	};
+
+	// Octree approximation of the charge field
+	//   E(p) = sum_j q_j (p - x_j) / |p - x_j|^2
+	// used by the sphere interaction in Scene::update. Nodes smaller than
+	// theta times their distance are treated as a single charge at their
+	// centre of |charge|; theta = 0 opens every node and gives the exact sum.
+	class BarnesHut
+	{
+		struct Node
+		{
+			glm::vec3 center;    // weighted by |charge|
+			float charge;        // net charge
+			float absCharge;     // zero when nothing inside is charged
+			glm::vec3 boxCenter;
+			float halfSize;
+			int firstChild;      // children are contiguous, -1 for leaves
+			int childCount;
+			int begin, end;      // bodies in order[begin, end)
+		};
+
+		std::vector<Node> nodes;
+		std::vector<int> order;
+		// Scratch for split's counting sort, indexed like order
+		std::vector<int> octants;
+		std::vector<int> sorted;
+		std::vector<glm::vec3> positions;
+		std::vector<float> charges;
+		int leafSize;
+
+		void split(int node, int depth);
+
+	public:
+		float theta;
+		BarnesHut(float theta);
+		void build(const glm::vec3* positions, const float* charges, int count);
+		// Field at p from every body except self (pass -1 to include all)
+		glm::vec3 field(glm::vec3 p, int self);
+		// The k-th body in the tree's order, where bodies close in space are
+		// mostly close in the list. Fields asked for in this order walk much
+		// the same nodes one after another and stay in cache.
+		int body(int k);
+	};
+
+}
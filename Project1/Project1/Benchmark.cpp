@@ -0,0 +1,366 @@
+// Headless benchmark of the scene core: Scene::update, Scene::map on its
+// own and through a broad phase query, Scene::normal, CpuRenderer frames,
+// baking static geometry whole and again where it changed, launching and
+// removing spheres and saving and loading snapshots, over scenes of N
+// charged spheres in a room. Opens no window and needs no GL;
+// built by CMakeLists.txt next to this file.
+//
+//   benchmark [-sizes 10,100,1000] [-time seconds] [-threads n]
+//             [-forces exact|bh] [-seed n] [-simd scalar|sse|avx2]
+//
+// Results go to stdout as CSV, one row per measurement, progress to stderr.
+#include "rme.h"
+#include "Profiler.h"
+#include "BroadPhase.h"
+#include "CpuRenderer.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+
+// xorshift32, so scenes are the same on every compiler and standard library
+struct Random
+{
+	unsigned int state;
+	Random(unsigned int seed) { state = seed ? seed : 1; }
+	float next()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state >> 8) * (1.0f / 16777216.0f);
+	}
+	float range(float lo, float hi) { return lo + (hi - lo) * next(); }
+};
+
+// The scene keeps pointers to what was added, so it owns them here
+struct BenchScene
+{
+	rme::Scene *scene;
+	rme::BoxInterior *room;
+	std::vector<rme::Sphere*> spheres;
+	glm::vec3 inner; // query points and spheres stay inside this
+	~BenchScene()
+	{
+		delete scene;
+		delete room;
+		for (int i = 0; i < spheres.size(); i++) delete spheres[i];
+	}
+};
+
+// N spheres set up like the ones in Initialize.cpp, in a room of the same
+// proportions as the default one, grown to keep about 40 units^3 per sphere.
+// The charge field falls off as 1/r, so at a fixed density it grows with
+// the room; charges shrink as the room grows to keep the field, and how
+// far spheres move in a step, the same for every N. Left at full charge,
+// 100000 spheres fly across several broad phase cells every step.
+void buildScene(BenchScene &bench, int count, unsigned int seed)
+{
+	rme::Scene *scene = bench.scene;
+	Random random(seed);
+	float scale = glm::max(1.0f, (float)std::cbrt(count * 40.0 / (30.0 * 16.0 * 36.0)));
+	glm::vec3 shape = glm::vec3(30.0, 16.0, 36.0) * scale;
+
+	rme::BoxInterior *room = new rme::BoxInterior(std::string("room"));
+	room->shape = shape;
+	scene->add(room);
+	bench.room = room;
+
+	glm::vec3 inner = shape - glm::vec3(1.0);
+	for (int i = 0; i < count; i++)
+	{
+		rme::Sphere *sphere = new rme::Sphere("sphere" + std::to_string(i));
+		sphere->position = glm::vec3(random.range(-inner.x, inner.x), random.range(-inner.y, inner.y), random.range(-inner.z, inner.z));
+		sphere->radius = 0.5;
+		sphere->charge = 0.15f / scale;
+		sphere->velocity = glm::vec3(random.range(0.0, 0.01), random.range(0.0, 0.01), random.range(0.0, 0.01));
+		sphere->physics = true;
+		scene->add(sphere);
+		bench.spheres.push_back(sphere);
+	}
+	bench.inner = inner;
+}
+
+// Static geometry for the bake rows: a ring, and a slab lift above it
+rme::StaticSdf *buildStatic(float lift)
+{
+	namespace sdf = rme::sdf;
+	return new rme::StaticSdf(sdf::unite(
+		sdf::translate(sdf::torus(glm::vec2(5.0f, 0.8f)), glm::vec3(0.0f, 4.0f, 0.0f)),
+		sdf::translate(sdf::roundBox(glm::vec3(4.0f, 0.5f, 4.0f), 0.2f), glm::vec3(0.0f, -8.0f + lift, 0.0f))),
+		glm::vec3(0.8f, 0.8f, 0.8f));
+}
+
+// Queries that disagree with the exact field: off by more than a voxel in
+// a brick, or past the surface where a cell keeps a single bound
+int bakeErrors(const rme::BrickMap &bake, const rme::StaticSdf *field, const std::vector<glm::vec3> &points)
+{
+	int errors = 0;
+	for (int q = 0; q < points.size(); q++)
+	{
+		glm::vec3 local = (points[q] - bake.origin) / bake.cellSize;
+		int c = int(local.x) + bake.dims.x * (int(local.y) + bake.dims.y * int(local.z));
+		float exact = field->distance(points[q]);
+		float d = bake.distance(points[q]);
+		bool ok = bake.slotOf[c] >= 0 ? std::fabs(d - exact) <= bake.voxelSize : d <= exact + 0.0001f;
+		if (!ok) errors++;
+	}
+	return errors;
+}
+
+double seconds(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+struct Result
+{
+	int iterations;
+	double total;
+	rme::LatencyHistogram perCall;
+};
+
+// Calls fn(batch) until minTime has passed, timing each batch of
+// batchSize calls. At least minBatches batches are run.
+template <typename F>
+Result measure(F fn, int batchSize, double minTime, int minBatches)
+{
+	Result result;
+	result.iterations = 0;
+	result.total = 0.0;
+	for (int batch = 0; batch < minBatches || result.total < minTime; batch++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		fn(batch);
+		double elapsed = seconds(start);
+		result.total += elapsed;
+		result.iterations += batchSize;
+		result.perCall.add(elapsed / batchSize);
+	}
+	return result;
+}
+
+void printResult(const char* name, int count, int threads, const char* forces, Result &result)
+{
+	std::printf("%s,%i,%i,%s,%s,%i,%.3f,%.4f,%.4f,%.4f\n", name, count, threads, rme::simdLevelName(rme::getSimdLevel()), forces,
+		result.iterations, result.total * 1000.0, result.total / result.iterations * 1000000.0,
+		result.perCall.percentile(0.5) * 1000000.0, result.perCall.percentile(0.99) * 1000000.0);
+	std::fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<int> sizes;
+	double minTime = 0.5;
+	int threads = 0;
+	bool useBarnesHut = true;
+	unsigned int seed = 1;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "-sizes") == 0 && i + 1 < argc)
+		{
+			for (char *s = argv[++i]; *s; )
+			{
+				sizes.push_back(std::atoi(s));
+				while (*s && *s != ',') s++;
+				if (*s) s++;
+			}
+		}
+		else if (std::strcmp(argv[i], "-time") == 0 && i + 1 < argc) minTime = std::atof(argv[++i]);
+		else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) threads = std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "-forces") == 0 && i + 1 < argc) useBarnesHut = std::strcmp(argv[++i], "bh") == 0;
+		else if (std::strcmp(argv[i], "-seed") == 0 && i + 1 < argc) seed = (unsigned int)std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "-simd") == 0 && i + 1 < argc)
+		{
+			const char* level = argv[++i];
+			rme::setSimdLevel(std::strcmp(level, "avx2") == 0 ? rme::SIMD_AVX2 : std::strcmp(level, "sse") == 0 ? rme::SIMD_SSE : rme::SIMD_SCALAR);
+		}
+		else
+		{
+			std::fprintf(stderr, "unknown argument %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (sizes.empty())
+	{
+		int defaults[] = { 10, 100, 1000, 10000, 100000 };
+		sizes.assign(defaults, defaults + 5);
+	}
+
+	rme::ThreadPool *pool = new rme::ThreadPool(threads);
+	bool failed = false;
+	const char* forces = useBarnesHut ? "bh" : "exact";
+
+	std::printf("benchmark,n,threads,simd,forces,iterations,total_ms,mean_us,p50_us,p99_us\n");
+	for (int s = 0; s < sizes.size(); s++)
+	{
+		int count = sizes[s];
+		BenchScene bench;
+		rme::Scene *scene = new rme::Scene();
+		scene->pool = pool;
+		scene->forceSolver = useBarnesHut ? rme::FORCE_BARNES_HUT : rme::FORCE_EXACT;
+		bench.scene = scene;
+		buildScene(bench, count, seed);
+		glm::vec3 inner = bench.inner;
+		std::fprintf(stderr, "n = %i\n", count);
+
+		// Seeded, so every run asks the same questions
+		const int queries = 1024;
+		Random random(seed + 1);
+		std::vector<glm::vec3> points(queries);
+		for (int q = 0; q < queries; q++)
+		{
+			points[q] = glm::vec3(random.range(-inner.x, inner.x), random.range(-inner.y, inner.y), random.range(-inner.z, inner.z));
+		}
+
+		// Queries run on the starting scene, before update() moves it
+		volatile float sink = 0.0f;
+		Result map = measure([&](int /*batch*/) {
+			float sum = 0.0f;
+			for (int q = 0; q < queries; q++) sum += scene->map(points[q], -1, nullptr, -1);
+			sink = sink + sum;
+		}, queries, minTime, 1);
+		printResult("map", count, pool->size(), forces, map);
+
+		// The same points as one packet, the lanes going across points
+		std::vector<float> px(queries), py(queries), pz(queries), packetDist(queries);
+		for (int q = 0; q < queries; q++)
+		{
+			px[q] = points[q].x;
+			py[q] = points[q].y;
+			pz[q] = points[q].z;
+		}
+		rme::PointPacket packet = { &px[0], &py[0], &pz[0], nullptr, queries };
+		Result mapPacket = measure([&](int /*batch*/) {
+			scene->mapPacket(packet, &packetDist[0]);
+			float sum = 0.0f;
+			for (int q = 0; q < queries; q++) sum += packetDist[q];
+			sink = sink + sum;
+		}, queries, minTime, 1);
+		printResult("map_packet", count, pool->size(), forces, mapPacket);
+
+		// As a colliding sphere asks in Scene::update: the objects a broad
+		// phase like the scene's finds within its radius, then map() over those
+		rme::BroadPhase broadPhase(4.0f);
+		for (int i = 0; i < scene->objects.size(); i++)
+		{
+			glm::vec3 position = scene->objects.position[i];
+			float radius = scene->objects.radius[i];
+			bool bounded = scene->objects.geometry[i] == SPHERE;
+			broadPhase.update(i, bounded, position - glm::vec3(radius), position + glm::vec3(radius));
+		}
+		std::vector<int> candidates;
+		Result mapBroad = measure([&](int /*batch*/) {
+			float sum = 0.0f;
+			for (int q = 0; q < queries; q++)
+			{
+				candidates.clear();
+				broadPhase.query(points[q], 0.5f, candidates);
+				sum += scene->map(points[q], -1, candidates.data(), candidates.size());
+			}
+			sink = sink + sum;
+		}, queries, minTime, 1);
+		printResult("map_broad", count, pool->size(), forces, mapBroad);
+
+		Result normal = measure([&](int /*batch*/) {
+			float sum = 0.0f;
+			for (int q = 0; q < queries; q++) sum += scene->normal(points[q], -1).x;
+			sink = sink + sum;
+		}, queries, minTime, 1);
+		printResult("normal", count, pool->size(), forces, normal);
+
+		// Whole frames through the tiled and grid culling map() takes while
+		// marching, from one end of the room looking down its length
+		rme::CpuRenderer renderer(320, 180, pool);
+		rme::Camera camera(std::string("camera"));
+		camera.position = glm::vec3(0.0f, 0.0f, -inner.z);
+		scene->viewRotation = glm::vec2(0.0f);
+		Result render = measure([&](int /*batch*/) {
+			renderer.render(scene, &camera);
+		}, 1, minTime, 3);
+		printResult("render", count, pool->size(), forces, render);
+
+		// The room baked as -static bakes, then the slab moved up and down,
+		// only the cells it reaches rebaked each time
+		const float lift = 3.0f;
+		rme::StaticSdf *fields[2] = { buildStatic(0.0f), buildStatic(lift) };
+		glm::vec3 shape = bench.room->shape;
+		rme::BrickMap *bake = nullptr;
+		Result bakeAll = measure([&](int /*batch*/) {
+			delete bake;
+			bake = new rme::BrickMap(fields[0], -shape, shape, 0.25f, 4.0f);
+			bake->bake(pool);
+		}, 1, minTime, 3);
+		printResult("bake", count, pool->size(), forces, bakeAll);
+		glm::vec3 slabLo = glm::vec3(-4.2f, -8.7f, -4.2f), slabHi = glm::vec3(4.2f, -7.3f + lift, 4.2f);
+		int current = 0;
+		Result rebake = measure([&](int /*batch*/) {
+			current = 1 - current;
+			bake->rebake(fields[current], slabLo, slabHi, pool);
+		}, 1, minTime, 3);
+		printResult("rebake", count, pool->size(), forces, rebake);
+		// Half the checks around the slab, where a missed cell would show
+		std::vector<glm::vec3> checks(4096);
+		glm::vec3 band = glm::vec3(bake->band);
+		glm::vec3 nearLo = glm::max(slabLo - band, -shape), nearHi = glm::min(slabHi + band, shape);
+		for (int q = 0; q < checks.size(); q++)
+		{
+			glm::vec3 lo = q % 2 ? nearLo : -shape, hi = q % 2 ? nearHi : shape;
+			checks[q] = glm::vec3(random.range(lo.x, hi.x), random.range(lo.y, hi.y), random.range(lo.z, hi.z)) * 0.999f;
+		}
+		int errors = bakeErrors(*bake, fields[current], checks);
+		if (errors > 0)
+		{
+			std::fprintf(stderr, "rebake: %i of %i queries disagree with the exact field\n", errors, int(checks.size()));
+			failed = true;
+		}
+		delete bake;
+		delete fields[0];
+		delete fields[1];
+
+		// The first steps settle overlapping spheres and are not counted
+		for (int i = 0; i < 2; i++) scene->update();
+		Result update = measure([&](int /*batch*/) {
+			scene->update();
+		}, 1, minTime, 3);
+		printResult("update", count, pool->size(), forces, update);
+
+		// One call is a launched sphere replacing the oldest, as a long
+		// session that caps its spheres would do
+		const int churn = 256;
+		std::vector<rme::ObjectHandle> launched;
+		rme::Sphere shot("");
+		shot.radius = 0.5;
+		shot.physics = true;
+		for (int i = 0; i < churn; i++) launched.push_back(scene->place(shot));
+		int oldest = 0;
+		Result spawn = measure([&](int /*batch*/) {
+			for (int i = 0; i < churn; i++)
+			{
+				scene->remove(launched[oldest]);
+				shot.position = glm::vec3(random.range(-inner.x, inner.x), random.range(-inner.y, inner.y), random.range(-inner.z, inner.z));
+				launched[oldest] = scene->place(shot);
+				oldest = (oldest + 1) % churn;
+			}
+		}, churn, minTime, 1);
+		printResult("spawn", count, pool->size(), forces, spawn);
+
+		// A whole scene to a snapshot and back; the file is fresh in the
+		// page cache, so this is the copy and not the disk
+		const char* snapshotFile = "benchmark.snapshot";
+		Result save = measure([&](int /*batch*/) {
+			scene->saveSnapshot(snapshotFile, 0);
+		}, 1, minTime, 3);
+		printResult("save", count, pool->size(), forces, save);
+		long long tick;
+		Result load = measure([&](int /*batch*/) {
+			scene->loadSnapshot(snapshotFile, tick);
+		}, 1, minTime, 3);
+		printResult("load", count, pool->size(), forces, load);
+		std::remove(snapshotFile);
+	}
+
+	delete pool;
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+#include "BrickMap.h"
+#include <chrono>
+#include <cmath>
+
+namespace rme
+{
+
+	// Runs fn over [0, count) on the pool, or inline without one
+	static void forEach(ThreadPool *pool, int count, std::function<void(int index, int worker)> fn)
+	{
+		if (pool) pool->parallelFor(count, fn);
+		else for (int i = 0; i < count; i++) fn(i, 0);
+	}
+
+	BrickMap::BrickMap(const StaticSdf *f, glm::vec3 lo, glm::vec3 hi, float voxel, float b)
+	{
+		field = f;
+		origin = lo;
+		voxelSize = voxel;
+		cellSize = voxel * BRICK_SIZE;
+		band = b;
+		glm::vec3 extent = (hi - lo) / cellSize;
+		dims = glm::ivec3(glm::max(1, int(std::ceil(extent.x))), glm::max(1, int(std::ceil(extent.y))), glm::max(1, int(std::ceil(extent.z))));
+		halfDiagonal = 0.5f * std::sqrt(3.0f) * cellSize;
+		slotOf.assign(dims.x * dims.y * dims.z, -1);
+		coarse.assign(dims.x * dims.y * dims.z, 0.0f);
+		cellsDirty = false;
+		bakeTime = 0.0;
+
+		std::string size = std::to_string(BRICK_SIZE), row = std::to_string(BRICK_ATLAS_ROW);
+		glsl =
+			"// rme::BrickMap: per cell the brick slot, -1 for none, and the\n"
+			"// value of a cell without one; bricks of " + size + "^3 voxels in an atlas\n"
+			"uniform sampler3D staticCells;\n"
+			"uniform sampler3D staticBricks;\n"
+			"uniform vec3 bakeOrigin;\n"
+			"uniform float bakeCellSize;\n"
+			"float staticMap(vec3 p)\n"
+			"{\n"
+			"\tvec3 local = (p - bakeOrigin) / bakeCellSize;\n"
+			"\tivec3 cell = ivec3(floor(local));\n"
+			"\tif (any(lessThan(cell, ivec3(0))) || any(greaterThanEqual(cell, textureSize(staticCells, 0)))) return staticExact(p);\n"
+			"\tvec2 entry = texelFetch(staticCells, cell, 0).rg;\n"
+			"\tif (entry.r < 0.0) return entry.g;\n"
+			"\tint slot = int(entry.r);\n"
+			"\tvec3 brick = vec3(slot % " + row + ", (slot / " + row + ") % " + row + ", slot / (" + row + " * " + row + ")) * " + std::to_string(BRICK_SIZE + 1) + ".0;\n"
+			"\t// Sample centres sit half a texel in, so filtering never reaches the next brick\n"
+			"\tvec3 texel = brick + 0.5 + (local - vec3(cell)) * " + size + ".0;\n"
+			"\treturn texture(staticBricks, texel / vec3(textureSize(staticBricks, 0))).r;\n"
+			"}\n";
+	}
+
+	int BrickMap::cellIndex(int x, int y, int z) const
+	{
+		return x + dims.x * (y + dims.y * z);
+	}
+
+	int BrickMap::brickCount() const
+	{
+		return slotCount() - freeSlots.size();
+	}
+
+	int BrickMap::slotCount() const
+	{
+		return samples.size() / BRICK_SAMPLES;
+	}
+
+	void BrickMap::bake(ThreadPool *pool)
+	{
+		pending.resize(slotOf.size());
+		for (int c = 0; c < pending.size(); c++) pending[c] = c;
+		bakeCells(pool);
+	}
+
+	void BrickMap::rebake(const StaticSdf *f, glm::vec3 lo, glm::vec3 hi, ThreadPool *pool)
+	{
+		field = f;
+		// Outside [lo, hi] the field only changed where the changed part is
+		// now, or was, the nearest: no further than the cell's own values
+		pending.clear();
+		for (int z = 0; z < dims.z; z++)
+		{
+			for (int y = 0; y < dims.y; y++)
+			{
+				for (int x = 0; x < dims.x; x++)
+				{
+					glm::vec3 cellLo = origin + glm::vec3(float(x), float(y), float(z)) * cellSize;
+					glm::vec3 gap = glm::max(glm::max(lo - (cellLo + glm::vec3(cellSize)), cellLo - hi), glm::vec3(0.0f));
+					int c = cellIndex(x, y, z);
+					float reach = slotOf[c] >= 0 ? band + 2.0f * halfDiagonal : std::fabs(coarse[c]);
+					if (glm::length(gap) < reach) pending.push_back(c);
+				}
+			}
+		}
+		bakeCells(pool);
+	}
+
+	void BrickMap::bakeCells(ThreadPool *pool)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		int count = pending.size();
+		pendingCentre.resize(count);
+		forEach(pool, count, [&](int n, int /*worker*/) {
+			int c = pending[n];
+			glm::vec3 cell = glm::vec3(float(c % dims.x), float((c / dims.x) % dims.y), float(c / (dims.x * dims.y)));
+			pendingCentre[n] = field->distance(origin + (cell + glm::vec3(0.5f)) * cellSize);
+		});
+
+		// Slots change hands here, then the bricks are filled side by side
+		filling.clear();
+		for (int n = 0; n < count; n++)
+		{
+			int c = pending[n];
+			float d = pendingCentre[n];
+			coarse[c] = d > 0.0f ? d - halfDiagonal : d + halfDiagonal;
+			if (std::fabs(d) - halfDiagonal < band)
+			{
+				if (slotOf[c] < 0)
+				{
+					if (!freeSlots.empty())
+					{
+						slotOf[c] = freeSlots.back();
+						freeSlots.pop_back();
+					}
+					else
+					{
+						slotOf[c] = slotCount();
+						samples.resize(samples.size() + BRICK_SAMPLES);
+					}
+				}
+				filling.push_back(c);
+				dirtySlots.push_back(slotOf[c]);
+			}
+			else if (slotOf[c] >= 0)
+			{
+				freeSlots.push_back(slotOf[c]);
+				slotOf[c] = -1;
+			}
+		}
+		if (count > 0) cellsDirty = true;
+
+		forEach(pool, filling.size(), [&](int n, int /*worker*/) {
+			int c = filling[n];
+			glm::vec3 corner = origin + glm::vec3(float(c % dims.x), float((c / dims.x) % dims.y), float(c / (dims.x * dims.y))) * cellSize;
+			float *brick = &samples[slotOf[c] * BRICK_SAMPLES];
+			for (int z = 0; z <= BRICK_SIZE; z++)
+			{
+				for (int y = 0; y <= BRICK_SIZE; y++)
+				{
+					for (int x = 0; x <= BRICK_SIZE; x++)
+					{
+						*brick++ = field->distance(corner + glm::vec3(float(x), float(y), float(z)) * voxelSize);
+					}
+				}
+			}
+		});
+		bakeTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	float BrickMap::distance(glm::vec3 p) const
+	{
+		glm::vec3 local = (p - origin) / cellSize;
+		if (!(local.x >= 0.0f && local.y >= 0.0f && local.z >= 0.0f &&
+			local.x < float(dims.x) && local.y < float(dims.y) && local.z < float(dims.z)))
+		{
+			return field->distance(p);
+		}
+		int x = int(local.x), y = int(local.y), z = int(local.z);
+		int c = cellIndex(x, y, z);
+		int slot = slotOf[c];
+		if (slot < 0) return coarse[c];
+
+		// The voxel within the brick and where p is inside it
+		glm::vec3 v = (local - glm::vec3(float(x), float(y), float(z))) * float(BRICK_SIZE);
+		int vx = glm::min(int(v.x), BRICK_SIZE - 1), vy = glm::min(int(v.y), BRICK_SIZE - 1), vz = glm::min(int(v.z), BRICK_SIZE - 1);
+		float tx = v.x - vx, ty = v.y - vy, tz = v.z - vz;
+		const int row = BRICK_SIZE + 1, layer = row * row;
+		const float *s = &samples[slot * BRICK_SAMPLES + vx + row * (vy + row * vz)];
+		float c00 = s[0] + (s[1] - s[0]) * tx;
+		float c10 = s[row] + (s[row + 1] - s[row]) * tx;
+		float c01 = s[layer] + (s[layer + 1] - s[layer]) * tx;
+		float c11 = s[layer + row] + (s[layer + row + 1] - s[layer + row]) * tx;
+		float c0 = c00 + (c10 - c00) * ty;
+		float c1 = c01 + (c11 - c01) * ty;
+		return c0 + (c1 - c0) * tz;
+	}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <glm.hpp>
+#include "Sdf.h"
+#include "ThreadPool.h"
+
+// Cells per brick edge; a brick stores the (BRICK_SIZE + 1)^3 distances at
+// its cell corners so it can be interpolated without its neighbours
+#define BRICK_SIZE 8
+#define BRICK_SAMPLES ((BRICK_SIZE + 1) * (BRICK_SIZE + 1) * (BRICK_SIZE + 1))
+// Bricks per row and per layer of the GPU atlas
+#define BRICK_ATLAS_ROW 32
+
+namespace rme
+{
+
+	// A StaticSdf sampled once into a sparse grid, so map() reads static
+	// distances with one trilinear lookup instead of walking the tree. The
+	// box is cut into coarse cells of BRICK_SIZE voxels. Cells the surface
+	// may come within band of get a brick of samples; the rest keep one
+	// value, a bound the field is at least as far as anywhere in the cell.
+	// Lookups outside the box fall back to the field itself.
+	//
+	// With band at least the largest collision radius, a collision query
+	// near an empty cell sees no contact, just as the exact field would.
+	class BrickMap
+	{
+		const StaticSdf *field;
+		float halfDiagonal;
+		std::vector<int> freeSlots;
+		// Cells being baked, and their centre distances
+		std::vector<int> pending;
+		std::vector<float> pendingCentre;
+		std::vector<int> filling;
+		int cellIndex(int x, int y, int z) const;
+		void bakeCells(ThreadPool *pool);
+
+	public:
+		glm::vec3 origin;
+		float voxelSize;
+		float cellSize; // voxelSize * BRICK_SIZE
+		float band;
+		glm::ivec3 dims;
+		// Per cell: the brick slot or -1, and the value of a cell without one
+		std::vector<int> slotOf;
+		std::vector<float> coarse;
+		// BRICK_SAMPLES per slot, x fastest; free slots hold stale samples
+		std::vector<float> samples;
+		// Changed since the renderer last took them
+		std::vector<int> dirtySlots;
+		bool cellsDirty;
+		// glsl for march.frag: a staticMap() reading the bake through the
+		// staticCells and staticBricks textures, falling back to staticExact()
+		std::string glsl;
+		double bakeTime; // seconds the bake took
+
+		// Covers [lo, hi] in cubes of voxelSize. Nothing is sampled until bake().
+		BrickMap(const StaticSdf *field, glm::vec3 lo, glm::vec3 hi, float voxelSize, float band);
+		// Samples every cell, spread over pool when given
+		void bake(ThreadPool *pool);
+		// Takes field in place of the old one and samples again only the
+		// cells whose values a change inside [lo, hi] could reach. Like
+		// bake(), not while the bake is being read.
+		void rebake(const StaticSdf *field, glm::vec3 lo, glm::vec3 hi, ThreadPool *pool);
+		float distance(glm::vec3 p) const;
+		int brickCount() const; // slots in use
+		int slotCount() const; // in use or free
+	};
+
+}
@@ -0,0 +1,154 @@
+#include "BroadPhase.h"
+
+namespace rme
+{
+
+	BroadPhase::BroadPhase(float size)
+	{
+		cellSize = size;
+	}
+
+	void BroadPhase::clear()
+	{
+		cells.clear();
+		entries.clear();
+		unbounded.clear();
+	}
+
+	int BroadPhase::size()
+	{
+		return entries.size();
+	}
+
+	long long BroadPhase::key(int x, int y, int z)
+	{
+		// 21 bits per axis covers +-1 million cells
+		return ((long long)(x & 0x1fffff) << 42) | ((long long)(y & 0x1fffff) << 21) | (long long)(z & 0x1fffff);
+	}
+
+	glm::ivec3 BroadPhase::cellOf(glm::vec3 p)
+	{
+		return glm::ivec3((int)glm::floor(p.x / cellSize), (int)glm::floor(p.y / cellSize), (int)glm::floor(p.z / cellSize));
+	}
+
+	void BroadPhase::unlink(int id)
+	{
+		Entry &e = entries[id];
+		if (e.kind == UNBOUNDED)
+		{
+			for (int i = 0; i < unbounded.size(); i++)
+			{
+				if (unbounded[i] != id) continue;
+				unbounded[i] = unbounded.back();
+				unbounded.pop_back();
+				break;
+			}
+		}
+		else if (e.kind == BOUNDED)
+		{
+			for (int x = e.lo.x; x <= e.hi.x; x++)
+			for (int y = e.lo.y; y <= e.hi.y; y++)
+			for (int z = e.lo.z; z <= e.hi.z; z++)
+			{
+				std::unordered_map<long long, std::vector<int> >::iterator cell = cells.find(key(x, y, z));
+				if (cell == cells.end()) continue;
+				std::vector<int> &ids = cell->second;
+				for (int i = 0; i < ids.size(); i++)
+				{
+					if (ids[i] != id) continue;
+					ids[i] = ids.back();
+					ids.pop_back();
+					break;
+				}
+				if (ids.empty()) cells.erase(cell);
+			}
+		}
+		e.kind = ABSENT;
+	}
+
+	void BroadPhase::link(int id)
+	{
+		Entry &e = entries[id];
+		if (e.kind == UNBOUNDED)
+		{
+			unbounded.push_back(id);
+		}
+		else if (e.kind == BOUNDED)
+		{
+			for (int x = e.lo.x; x <= e.hi.x; x++)
+			for (int y = e.lo.y; y <= e.hi.y; y++)
+			for (int z = e.lo.z; z <= e.hi.z; z++)
+			{
+				cells[key(x, y, z)].push_back(id);
+			}
+		}
+	}
+
+	void BroadPhase::update(int id, bool bounded, glm::vec3 lo, glm::vec3 hi)
+	{
+		if (id >= entries.size())
+		{
+			Entry absent;
+			absent.kind = ABSENT;
+			entries.resize(id + 1, absent);
+		}
+		Entry &e = entries[id];
+		if (bounded)
+		{
+			glm::ivec3 cellLo = cellOf(lo);
+			glm::ivec3 cellHi = cellOf(hi);
+			if (e.kind == BOUNDED && e.lo == cellLo && e.hi == cellHi) return;
+			unlink(id);
+			e.kind = BOUNDED;
+			e.lo = cellLo;
+			e.hi = cellHi;
+		}
+		else
+		{
+			if (e.kind == UNBOUNDED) return;
+			unlink(id);
+			e.kind = UNBOUNDED;
+		}
+		link(id);
+	}
+
+	void BroadPhase::remove(int id)
+	{
+		if (id < entries.size()) unlink(id);
+	}
+
+	void BroadPhase::query(glm::vec3 p, float radius, std::vector<int> &out)
+	{
+		query(p, radius, out, ownStamps);
+	}
+
+	void BroadPhase::query(glm::vec3 p, float radius, std::vector<int> &out, QueryStamps &scratch)
+	{
+		// Stamps keep objects spanning several cells from being listed twice
+		if (scratch.stamps.size() < entries.size()) scratch.stamps.resize(entries.size(), scratch.current);
+		unsigned int stamp = ++scratch.current;
+		std::vector<unsigned int> &stamps = scratch.stamps;
+		for (int i = 0; i < unbounded.size(); i++)
+		{
+			out.push_back(unbounded[i]);
+		}
+		glm::ivec3 lo = cellOf(p - glm::vec3(radius));
+		glm::ivec3 hi = cellOf(p + glm::vec3(radius));
+		for (int x = lo.x; x <= hi.x; x++)
+		for (int y = lo.y; y <= hi.y; y++)
+		for (int z = lo.z; z <= hi.z; z++)
+		{
+			std::unordered_map<long long, std::vector<int> >::const_iterator cell = cells.find(key(x, y, z));
+			if (cell == cells.end()) continue;
+			const std::vector<int> &ids = cell->second;
+			for (int i = 0; i < ids.size(); i++)
+			{
+				int id = ids[i];
+				if (stamps[id] == stamp) continue;
+				stamps[id] = stamp;
+				out.push_back(id);
+			}
+		}
+	}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <glm.hpp>
+
+namespace rme
+{
+
+	// Spatial hash over object bounds, keyed by the index an object has in
+	// the scene's ObjectStore. Bounded objects live in every cell their box touches;
+	// unbounded ones (a room seen from inside is close to every point) are
+	// returned by every query. Moving an object only touches the hash when the
+	// range of cells it covers changes.
+	class BroadPhase
+	{
+	public:
+		// Dedupe state for one querying thread; the hash itself is only read
+		struct QueryStamps
+		{
+			std::vector<unsigned int> stamps;
+			unsigned int current;
+			QueryStamps() : current(0) {}
+		};
+
+	private:
+		enum Kind
+		{
+			ABSENT,
+			BOUNDED,
+			UNBOUNDED
+		};
+
+		struct Entry
+		{
+			int kind;
+			glm::ivec3 lo, hi;
+		};
+
+		float cellSize;
+		std::unordered_map<long long, std::vector<int> > cells;
+		std::vector<Entry> entries;
+		std::vector<int> unbounded;
+		QueryStamps ownStamps;
+
+		long long key(int x, int y, int z);
+		glm::ivec3 cellOf(glm::vec3 p);
+		void unlink(int id);
+		void link(int id);
+
+	public:
+		BroadPhase(float cellSize);
+		void clear();
+		// Registers or moves an object. Passing unbounded ignores lo and hi.
+		void update(int id, bool bounded, glm::vec3 lo, glm::vec3 hi);
+		void remove(int id);
+		// Appends every object whose bounds may come within radius of p
+		void query(glm::vec3 p, float radius, std::vector<int> &out);
+		// Same, safe to call from several threads at once between updates
+		void query(glm::vec3 p, float radius, std::vector<int> &out, QueryStamps &stamps);
+		int size();
+	};
+
+}
@@ -0,0 +1,82 @@
+#include "CameraPath.h"
+#include <cstdio>
+
+namespace rme
+{
+
+	bool CameraPath::load(const char* filename)
+	{
+		FILE *file = std::fopen(filename, "r");
+		if (!file)
+		{
+			std::printf("Could not open camera path %s\n", filename);
+			return false;
+		}
+		keys.clear();
+		char line[256];
+		int lineNumber = 0;
+		bool ok = true;
+		while (ok && std::fgets(line, sizeof(line), file))
+		{
+			lineNumber++;
+			for (char *c = line; *c; c++)
+			{
+				if (*c == '#') *c = 0;
+			}
+			Key key;
+			double x, y, z, yaw, pitch;
+			int fields = std::sscanf(line, "%lf %lf %lf %lf %lf %lf", &key.time, &x, &y, &z, &yaw, &pitch);
+			if (fields <= 0) continue;
+			ok = fields == 6 && (keys.empty() || key.time > keys.back().time);
+			key.position = glm::vec3(float(x), float(y), float(z));
+			key.rotation = glm::vec2(float(yaw), float(pitch));
+			if (ok) keys.push_back(key);
+		}
+		std::fclose(file);
+		if (!ok || keys.empty())
+		{
+			if (ok) std::printf("Camera path %s has no keys\n", filename);
+			else std::printf("Camera path %s is not valid at line %i\n", filename, lineNumber);
+			keys.clear();
+			return false;
+		}
+		return true;
+	}
+
+	bool CameraPath::empty()
+	{
+		return keys.empty();
+	}
+
+	template <typename T>
+	static T catmullRom(const T &p0, const T &p1, const T &p2, const T &p3, float t)
+	{
+		float t2 = t * t, t3 = t2 * t;
+		return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+	}
+
+	void CameraPath::sample(double time, glm::vec3 &position, glm::vec2 &rotation)
+	{
+		int last = keys.size() - 1;
+		if (last <= 0 || time <= keys[0].time)
+		{
+			position = keys[0].position;
+			rotation = keys[0].rotation;
+			return;
+		}
+		if (time >= keys[last].time)
+		{
+			position = keys[last].position;
+			rotation = keys[last].rotation;
+			return;
+		}
+		int k = 0;
+		while (keys[k + 1].time <= time) k++;
+		// The ends are repeated for the neighbours the spline lacks there
+		const Key &k0 = keys[k > 0 ? k - 1 : 0], &k1 = keys[k], &k2 = keys[k + 1], &k3 = keys[k + 2 <= last ? k + 2 : last];
+		float t = float((time - k1.time) / (k2.time - k1.time));
+		position = catmullRom(k0.position, k1.position, k2.position, k3.position, t);
+		rotation = catmullRom(k0.rotation, k1.rotation, k2.rotation, k3.rotation, t);
+	}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include <glm.hpp>
+
+namespace rme
+{
+
+	// Scripted camera for offline renders: keys of time, position and view
+	// angles, passed through on a Catmull-Rom spline so the camera does not
+	// jerk at them. Held on the first and last key outside their times.
+	class CameraPath
+	{
+		struct Key
+		{
+			double time; // seconds of simulation
+			glm::vec3 position;
+			glm::vec2 rotation; // as Scene::viewRotation
+		};
+		std::vector<Key> keys;
+
+	public:
+		// A text file of one key per line, "time x y z yaw pitch", in
+		// increasing time. Blank lines and lines from # on are skipped.
+		bool load(const char* filename);
+		bool empty();
+		void sample(double time, glm::vec3 &position, glm::vec2 &rotation);
+	};
+
+}
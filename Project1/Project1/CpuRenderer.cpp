@@ -0,0 +1,353 @@
+#include "CpuRenderer.h"
+#include "Image.h"
+#include <chrono>
+#include <cmath>
+
+namespace rme
+{
+
+	static glm::vec2 rot2D(glm::vec2 p, float angle)
+	{
+		float s = glm::sin(angle);
+		float c = glm::cos(angle);
+		return p * glm::mat2(c, s, -s, c);
+	}
+
+	CpuRenderer::CpuRenderer(int w, int h, ThreadPool *p)
+	{
+		width = w;
+		height = h;
+		tileSize = 16;
+		ownsPool = p == nullptr;
+		pool = ownsPool ? new ThreadPool(0) : p;
+		pixels.resize(width * height * 3);
+		staticGeometry = nullptr;
+		staticBake = nullptr;
+		lastRenderTime = 0.0;
+		statsMode = STATS_OFF;
+	}
+
+	CpuRenderer::~CpuRenderer()
+	{
+		if (ownsPool) delete pool;
+	}
+
+	// Same data RaymarchRenderer uploads, including the grid
+	void CpuRenderer::updateFrame(Scene* scene, Camera* camera)
+	{
+		ObjectStore &store = scene->objects;
+		cameraRotation = scene->viewRotation;
+		cameraPos = camera->slot >= 0 ? scene->renderPosition(camera->slot) : camera->position;
+
+		objects.resize(store.size());
+		for (int i = 0; i < store.size(); i++)
+		{
+			FrameObject &obj = objects[i];
+			obj.position = scene->renderPosition(i);
+			obj.radius = store.radius[i];
+			obj.age = store.age[i];
+			obj.shape = store.shape[i];
+			obj.geometry = store.geometry[i];
+			obj.color = store.color[i];
+		}
+		staticGeometry = scene->staticGeometry;
+		staticBake = scene->staticBake;
+		grid.build(scene);
+		tiles.build(scene, grid, cameraPos, cameraRotation, width, height);
+	}
+
+	inline void CpuRenderer::testObject(const FrameObject &obj, int i, glm::vec3 p, float &dist, int &closestIndex)
+	{
+		float altDist;
+		switch (obj.geometry) {
+		case SPHERE:
+			altDist = glm::length(p - obj.position) - obj.radius;
+			if (altDist < dist) {
+				dist = altDist;
+				closestIndex = i;
+			}
+			break;
+		case BOX_INTERIOR:
+		{
+			glm::vec3 d = glm::abs(p - obj.position) - obj.shape;
+			altDist = -(glm::min(glm::max(d.x, glm::max(d.y, d.z)), 0.0f) + glm::length(glm::max(d, glm::vec3(0.0f))));
+			if (altDist < dist) {
+				dist = altDist;
+				closestIndex = i;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	float CpuRenderer::map(glm::vec3 p, int &closestIndex, const int *list, int count, int &tested)
+	{
+		float dist = 1000000.0f;
+		if (staticGeometry) {
+			float staticDist = staticBake ? staticBake->distance(p) : staticGeometry->distance(p);
+			if (staticDist < dist) {
+				dist = staticDist;
+				closestIndex = -1;
+			}
+		}
+		for (int n = 0; n < count; n++) {
+			int i = list[n];
+			testObject(objects[i], i, p, dist, closestIndex);
+		}
+		tested += count;
+		if (!grid.cells.empty()) dist = mapGrid(p, dist, closestIndex, tested);
+		return dist;
+	}
+
+	float CpuRenderer::mapGrid(glm::vec3 p, float dist, int &closestIndex, int &tested)
+	{
+		glm::vec3 local = (p - grid.origin) / grid.cellSize;
+		glm::ivec3 cell = glm::ivec3((int)glm::floor(local.x), (int)glm::floor(local.y), (int)glm::floor(local.z));
+		if (cell.x >= 0 && cell.y >= 0 && cell.z >= 0 && cell.x < grid.dims.x && cell.y < grid.dims.y && cell.z < grid.dims.z) {
+			int index = 2 * (cell.x + grid.dims.x*(cell.y + grid.dims.y*cell.z));
+			int first = grid.cells[index];
+			int count = grid.cells[index + 1];
+			for (int n = 0; n < count; n++) {
+				int i = grid.cellObjects[first + n];
+				testObject(objects[i], i, p, dist, closestIndex);
+			}
+			tested += count;
+			// Anything not listed is at least this far, and empty cells know
+			// how many more empty cells surround them
+			glm::vec3 f = local - glm::vec3(float(cell.x), float(cell.y), float(cell.z));
+			glm::vec3 toEdge = glm::min(f, 1.0f - f);
+			float skip = count == 0 ? float(first - 1) : 0.0f;
+			dist = glm::min(dist, (glm::min(toEdge.x, glm::min(toEdge.y, toEdge.z)) + skip)*grid.cellSize + grid.margin);
+		}
+		else {
+			glm::vec3 gridEnd = grid.origin + glm::vec3(float(grid.dims.x), float(grid.dims.y), float(grid.dims.z))*grid.cellSize;
+			glm::vec3 outside = glm::max(glm::max(grid.origin - p, p - gridEnd), glm::vec3(0.0f));
+			dist = glm::min(dist, glm::length(outside) + grid.margin);
+		}
+		return dist;
+	}
+
+	// Pull on a ray at p from one warp end, faded out to none at the edge of
+	// its influence so rays do not kink crossing it
+	static glm::vec3 warpPull(glm::vec3 p, glm::vec3 end, float influence)
+	{
+		glm::vec3 diff = p - end;
+		float length = glm::length(diff);
+		if (length >= influence) return glm::vec3(0.0f);
+		float fade = 1.0f - length*length / (influence*influence);
+		return 1.2f * fade*fade / (length*length*length) * diff;
+	}
+
+	void CpuRenderer::intersect(Ray &r, int &closestIndex, const int *tile, bool bent, PixelCost &cost)
+	{
+		const float maxDist = 280.0f;
+		const float epsilon = 0.005f;
+		float totalD = 0.0f;
+		cost.marches++;
+		for (int i = 0; i < 96; i++)
+		{
+			cost.steps++;
+			// Bent towards the warps the ray is within reach of
+			int count = bent ? int(tiles.pairs.size()) : tile[1];
+			glm::vec3 pull = glm::vec3(0.0f);
+			for (int n = 0; n < count; n++) {
+				const ScreenTiles::Pair &pair = tiles.pairs[bent ? n : tiles.warpList[tile[0] + n]];
+				pull += warpPull(r.position, pair.a, pair.influence) + warpPull(r.position, pair.b, pair.influence);
+			}
+			if (pull != glm::vec3(0.0f)) bent = true;
+
+			// A bent ray can leave its tile's cone, this step's included, so
+			// it tests everything
+			const int *list = tiles.objectList.data() + (bent ? 0 : tile[2]);
+			float minDist = map(r.position, closestIndex, list, bent ? tiles.globalCount : tile[3], cost.objects);
+			if (pull != glm::vec3(0.0f)) r.direction = glm::normalize(r.direction - minDist * pull);
+
+			r.position += r.direction * minDist * 0.65f;
+
+			totalD += minDist;
+			if (minDist < epsilon || totalD > maxDist) break;
+		}
+	}
+
+	glm::vec3 CpuRenderer::calcNormal(glm::vec3 p, int closestIndex)
+	{
+		if (closestIndex < 0) {
+			// Four taps at the corners of a tetrahedron
+			const float eps = 0.002f;
+			glm::vec3 a = glm::vec3(1.0f, -1.0f, -1.0f), b = glm::vec3(-1.0f, -1.0f, 1.0f);
+			glm::vec3 c = glm::vec3(-1.0f, 1.0f, -1.0f), d = glm::vec3(1.0f, 1.0f, 1.0f);
+			return glm::normalize(
+				a*staticGeometry->distance(p + a*eps) + b*staticGeometry->distance(p + b*eps) +
+				c*staticGeometry->distance(p + c*eps) + d*staticGeometry->distance(p + d*eps));
+		}
+		const FrameObject &obj = objects[closestIndex];
+		if (obj.geometry == SPHERE) return glm::normalize(p - obj.position);
+		return -sdf::boxGradient(p - obj.position, obj.shape);
+	}
+
+	// main() of march.frag for one fragment centre
+	glm::vec3 CpuRenderer::shade(float fragX, float fragY, PixelCost &cost)
+	{
+		glm::vec2 uv = glm::vec2(fragX / width, fragY / height) * 2.0f - 1.0f;
+		uv.x *= float(width) / float(height);
+
+		Ray ray;
+		ray.position = cameraPos;
+		ray.direction = glm::normalize(glm::vec3(uv.x, uv.y, 1.2f));
+
+		glm::vec2 yz = rot2D(glm::vec2(ray.direction.y, ray.direction.z), cameraRotation.y);
+		ray.direction.y = yz.x;
+		ray.direction.z = yz.y;
+		glm::vec2 xz = rot2D(glm::vec2(ray.direction.x, ray.direction.z), cameraRotation.x);
+		ray.direction.x = xz.x;
+		ray.direction.z = xz.y;
+
+		int closestIndex = 0;
+		const int *tile = &tiles.tiles[tiles.tileAt(fragX, fragY)];
+
+		intersect(ray, closestIndex, tile, false, cost);
+
+		for (int timesWarped = 0; timesWarped < 2; timesWarped++) {
+
+			if (closestIndex < 0) break;
+			const FrameObject &closest = objects[closestIndex];
+
+			if (closest.geometry == SPHERE) {
+				// Out of the other end if it is a warp
+				for (int n = 0; n < tiles.pairs.size(); n++) {
+					const ScreenTiles::Pair &pair = tiles.pairs[n];
+					if (pair.indexA == closestIndex) {
+						ray.position += pair.b - pair.a;
+						break;
+					}
+					if (pair.indexB == closestIndex) {
+						ray.position += pair.a - pair.b;
+						break;
+					}
+				}
+				ray.direction = -ray.direction;
+				ray.position += ray.direction * 0.2f;
+				intersect(ray, closestIndex, tile, true, cost);
+			}
+
+		}
+
+		FrameObject closest;
+		glm::vec3 color1 = staticGeometry ? staticGeometry->color : glm::vec3(0.0f);
+		if (closestIndex < 0) {
+			closest.geometry = -1;
+		}
+		else {
+			closest = objects[closestIndex];
+			color1 = closest.color;
+		}
+		if (closest.geometry == SPHERE) {
+			color1.x = glm::sin(closest.age*0.04f)*0.5f + 0.5f;
+		}
+		else if (closest.geometry == BOX_INTERIOR) {
+			glm::vec3 p = 0.35f*ray.position;
+			if ((int(glm::floor(p.x) + glm::floor(p.y) + glm::floor(p.z)) & 1) == 0) {
+				color1 = glm::vec3(p.x / 8.0f + 0.5f, p.y / 8.0f + 0.5f, p.z / 8.0f + 0.5f);
+			}
+			else {
+				color1 = glm::vec3(0.7f, 0.7f, 0.7f);
+			}
+		}
+
+		glm::vec3 normal = calcNormal(ray.position, closestIndex);
+
+		ray.direction = glm::reflect(ray.direction, normal);
+
+		return color1*(glm::dot(normal, ray.direction) + 0.2f);
+	}
+
+	// march.frag's heat(), blue through green to red over [0, 1]
+	static glm::vec3 heat(float t)
+	{
+		t = glm::clamp(t, 0.0f, 1.0f);
+		glm::vec3 c = glm::vec3(1.5f - glm::abs(4.0f * t - 3.0f), 1.5f - glm::abs(4.0f * t - 2.0f), 1.5f - glm::abs(4.0f * t - 1.0f));
+		return glm::clamp(c, glm::vec3(0.0f), glm::vec3(1.0f));
+	}
+
+	// march.frag's statsHeat()
+	static float statsHeat(int mode, int steps, int objects, int marches)
+	{
+		if (mode == STATS_STEPS) return steps / 96.0f;
+		if (mode == STATS_MARCHES) return (marches - 1) / float(STATS_MARCHES_MAX - 1);
+		return std::log2(objects + 1.0f) / 12.0f;
+	}
+
+	static unsigned char toUnorm8(float c)
+	{
+		// NaN and negatives both land on 0, like the GL framebuffer conversion
+		if (!(c > 0.0f)) return 0;
+		if (c >= 1.0f) return 255;
+		return (unsigned char)(c*255.0f + 0.5f);
+	}
+
+	void CpuRenderer::renderTile(int tile, int worker)
+	{
+		int tilesX = (width + tileSize - 1) / tileSize;
+		int x0 = (tile % tilesX) * tileSize;
+		int y0 = (tile / tilesX) * tileSize;
+		int x1 = glm::min(x0 + tileSize, width);
+		int y1 = glm::min(y0 + tileSize, height);
+		for (int y = y0; y < y1; y++)
+		{
+			// gl_FragCoord has its origin at the bottom left
+			unsigned char *row = &pixels[(height - 1 - y) * width * 3];
+			for (int x = x0; x < x1; x++)
+			{
+				PixelCost cost = { 0, 0, 0 };
+				glm::vec3 c = shade(x + 0.5f, y + 0.5f, cost);
+				if (statsMode != STATS_OFF) {
+					c = glm::mix(c, heat(statsHeat(statsMode, cost.steps, cost.objects, cost.marches)), 0.7f);
+					workerStats[worker].addPixel(cost.steps, cost.objects, cost.marches);
+				}
+				row[x * 3 + 0] = toUnorm8(c.x);
+				row[x * 3 + 1] = toUnorm8(c.y);
+				row[x * 3 + 2] = toUnorm8(c.z);
+			}
+		}
+	}
+
+	void CpuRenderer::render(Scene* scene, Camera* camera)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		updateFrame(scene, camera);
+
+		int tilesX = (width + tileSize - 1) / tileSize;
+		int tilesY = (height + tileSize - 1) / tileSize;
+		workerStats.resize(pool->size());
+		for (int i = 0; i < workerStats.size(); i++) workerStats[i].clear();
+		pool->parallelFor(tilesX * tilesY, [this](int tile, int worker) { renderTile(tile, worker); });
+		stats.clear();
+		for (int i = 0; i < workerStats.size(); i++) stats.add(workerStats[i]);
+
+		lastRenderTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	const unsigned char* CpuRenderer::data()
+	{
+		return &pixels[0];
+	}
+
+	int CpuRenderer::getWidth()
+	{
+		return width;
+	}
+
+	int CpuRenderer::getHeight()
+	{
+		return height;
+	}
+
+	bool CpuRenderer::save(const char* filename)
+	{
+		return writeImage(filename, &pixels[0], width, height);
+	}
+
+}
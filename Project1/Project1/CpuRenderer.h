@@ -0,0 +1,86 @@
+#pragma once
+#include "rme.h"
+#include "ThreadPool.h"
+#include "SceneGrid.h"
+#include "ScreenTiles.h"
+#include "RenderStats.h"
+
+namespace rme
+{
+
+	// Headless port of shaders/march.frag. Takes the same Scene and Camera as
+	// RaymarchRenderer and marches screen tiles in parallel on the CPU, so
+	// frames can be produced on machines without a GPU and kept as references.
+	class CpuRenderer
+	{
+		struct Ray
+		{
+			glm::vec3 position;
+			glm::vec3 direction;
+		};
+
+		// Mirrors the Object3D buffer uploaded by RaymarchRenderer
+		struct FrameObject
+		{
+			glm::vec3 position;
+			float radius;
+			float age;
+			glm::vec3 shape;
+			int geometry;
+			glm::vec3 color;
+		};
+
+		// What one pixel's march cost
+		struct PixelCost
+		{
+			int steps, objects, marches;
+		};
+
+		int width, height;
+		int tileSize;
+		ThreadPool *pool;
+		bool ownsPool;
+		std::vector<unsigned char> pixels;
+
+		std::vector<FrameObject> objects;
+		SceneGrid grid;
+		const StaticSdf *staticGeometry;
+		const BrickMap *staticBake; // marched through when set, never shaded
+		ScreenTiles tiles;
+		glm::vec3 cameraPos;
+		glm::vec2 cameraRotation;
+		std::vector<RenderStats> workerStats;
+
+		void updateFrame(Scene* scene, Camera* camera);
+		void testObject(const FrameObject &obj, int i, glm::vec3 p, float &dist, int &closestIndex);
+		// Tests the count objects listed from list as well as the grid,
+		// adding how many it tested to tested
+		float map(glm::vec3 p, int &closestIndex, const int *list, int count, int &tested);
+		// The part of map() that walks the grid, kept apart so the small
+		// scene case stays compact
+		float mapGrid(glm::vec3 p, float dist, int &closestIndex, int &tested);
+		// tile is the ray's entry in tiles.tiles, whose warps and objects are
+		// all it is tested against until bent
+		void intersect(Ray &r, int &closestIndex, const int *tile, bool bent, PixelCost &cost);
+		// Of the object at closestIndex, or of the static geometry for -1
+		glm::vec3 calcNormal(glm::vec3 p, int closestIndex);
+		glm::vec3 shade(float fragX, float fragY, PixelCost &cost);
+		void renderTile(int tile, int worker);
+
+	public:
+		// pool may be null, in which case the renderer makes one using every core
+		CpuRenderer(int w, int h, ThreadPool *pool);
+		~CpuRenderer();
+		double lastRenderTime; // seconds
+		// Unless STATS_OFF, each pixel is tinted by what it cost, as in
+		// march.frag, and stats holds the totals of the last frame
+		int statsMode;
+		RenderStats stats;
+		void render(Scene* scene, Camera* camera);
+		const unsigned char* data();
+		int getWidth();
+		int getHeight();
+		bool save(const char* filename);
+	};
+
+}
@@ -0,0 +1,106 @@
+#include "FrameWriter.h"
+#include "Image.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+namespace rme
+{
+
+	FrameWriter::FrameWriter(const std::string &p, int threads, int limit)
+	{
+		prefix = p;
+		if (threads <= 0)
+			threads = std::max(1, (int)std::thread::hardware_concurrency());
+		maxQueued = std::max(1, limit);
+		writing = 0;
+		stopping = false;
+		framesWritten = 0;
+		failures = 0;
+		for (int i = 0; i < threads; i++)
+		{
+			workers.push_back(std::thread(&FrameWriter::workerLoop, this));
+		}
+	}
+
+	FrameWriter::~FrameWriter()
+	{
+		finish();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		queued.notify_all();
+		for (int i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+		for (int i = 0; i < spare.size(); i++) delete spare[i];
+	}
+
+	void FrameWriter::submit(int number, std::vector<unsigned char> &rgb, int width, int height, bool bottomUp)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (queue.size() >= maxQueued) freed.wait(lock);
+		Job *job;
+		if (spare.empty()) job = new Job();
+		else
+		{
+			job = spare.back();
+			spare.pop_back();
+		}
+		job->number = number;
+		job->width = width;
+		job->height = height;
+		job->bottomUp = bottomUp;
+		job->rgb.swap(rgb);
+		// What comes back was the buffer of an earlier frame, if any
+		rgb.resize((size_t)width * height * 3);
+		queue.push_back(job);
+		lock.unlock();
+		queued.notify_one();
+	}
+
+	void FrameWriter::finish()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!queue.empty() || writing > 0) freed.wait(lock);
+	}
+
+	void FrameWriter::workerLoop()
+	{
+		std::vector<unsigned char> flipped;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			while (queue.empty() && !stopping) queued.wait(lock);
+			if (queue.empty()) return;
+			Job *job = queue.front();
+			queue.erase(queue.begin());
+			writing++;
+			lock.unlock();
+			freed.notify_all();
+
+			const unsigned char *rows = &job->rgb[0];
+			if (job->bottomUp)
+			{
+				size_t stride = (size_t)job->width * 3;
+				flipped.resize(stride * job->height);
+				for (int y = 0; y < job->height; y++)
+					std::memcpy(&flipped[y * stride], &job->rgb[(job->height - 1 - y) * stride], stride);
+				rows = &flipped[0];
+			}
+			char number[16];
+			std::sprintf(number, "%05d", job->number);
+			bool written = writePNG((prefix + number + ".png").c_str(), rows, job->width, job->height);
+
+			lock.lock();
+			writing--;
+			if (written) framesWritten++;
+			else failures++;
+			spare.push_back(job);
+			freed.notify_all();
+		}
+	}
+
+}
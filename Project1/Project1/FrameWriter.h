@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace rme
+{
+
+	// Writes numbered PNGs of a frame sequence on encoder threads of its
+	// own, so whoever produces the frames only waits once as many as the
+	// queue holds are still unwritten. Buffers are handed over by swapping,
+	// and come back empty but with their storage, so a steady run does not
+	// allocate.
+	class FrameWriter
+	{
+		struct Job
+		{
+			int number;
+			int width, height;
+			bool bottomUp; // rows as glReadPixels gives them
+			std::vector<unsigned char> rgb;
+		};
+
+		std::string prefix;
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable queued; // a job came in or stopping was set
+		std::condition_variable freed; // a job was taken or finished
+		std::vector<Job*> queue; // oldest first
+		std::vector<Job*> spare;
+		int maxQueued;
+		int writing;
+		bool stopping;
+		void workerLoop();
+
+	public:
+		// Counted once written, or once the file could not be opened
+		int framesWritten;
+		int failures;
+		// Frame n goes to prefix followed by n in five digits and .png.
+		// threads <= 0 uses every hardware thread.
+		FrameWriter(const std::string &prefix, int threads, int maxQueued);
+		~FrameWriter();
+		// Takes rgb's contents, leaving it with a buffer of the right size
+		// for the next frame. Waits while maxQueued frames are still waiting
+		// for an encoder.
+		void submit(int number, std::vector<unsigned char> &rgb, int width, int height, bool bottomUp);
+		// Waits until every frame submitted has been written
+		void finish();
+	};
+
+}
@@ -0,0 +1,70 @@
+#include "GpuTimer.h"
+
+namespace rme
+{
+
+	GpuTimer::GpuTimer(int depth)
+	{
+		queries.resize(depth);
+		frames.resize(depth);
+		starts.resize(depth);
+		glGenQueries(depth, &queries[0]);
+		oldest = 0;
+		inFlight = 0;
+		timing = false;
+		skipped = 0;
+		lastFrame = -1;
+		lastElapsed = 0.0;
+	}
+
+	GpuTimer::~GpuTimer()
+	{
+		glDeleteQueries(queries.size(), &queries[0]);
+	}
+
+	void GpuTimer::begin(long long frame, double cpuStart)
+	{
+		int depth = queries.size();
+		if (inFlight == depth)
+		{
+			skipped++;
+			return;
+		}
+		int slot = (oldest + inFlight) % depth;
+		frames[slot] = frame;
+		starts[slot] = cpuStart;
+		glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+		timing = true;
+	}
+
+	void GpuTimer::end()
+	{
+		if (!timing) return;
+		glEndQuery(GL_TIME_ELAPSED);
+		timing = false;
+		inFlight++;
+	}
+
+	int GpuTimer::collect(Profiler *profiler)
+	{
+		// Queries finish in the order they were issued
+		int finished = 0;
+		while (inFlight > 0)
+		{
+			GLuint query = queries[oldest];
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break;
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			lastFrame = frames[oldest];
+			lastElapsed = elapsed / 1000000000.0;
+			if (profiler) profiler->record(STAGE_GPU, lastFrame, starts[oldest], lastElapsed);
+			oldest = (oldest + 1) % queries.size();
+			inFlight--;
+			finished++;
+		}
+		return finished;
+	}
+
+}
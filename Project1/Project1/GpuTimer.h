@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <GL/glew.h>
+#include "Profiler.h"
+
+namespace rme
+{
+
+	// GL_TIME_ELAPSED queries around a stretch of GL commands, in a ring so
+	// results are read frames later, once the GPU has them. Nothing here
+	// waits: with every query still in flight a frame goes untimed.
+	class GpuTimer
+	{
+		std::vector<GLuint> queries;
+		std::vector<long long> frames;
+		std::vector<double> starts;
+		int oldest;
+		int inFlight;
+		bool timing;
+
+	public:
+		int skipped; // frames not timed because the ring was full
+		// The newest result, -1 for the frame until there is one
+		long long lastFrame;
+		double lastElapsed;
+		GpuTimer(int depth);
+		~GpuTimer();
+		// cpuStart places the result on the profiler's timeline
+		void begin(long long frame, double cpuStart);
+		void end();
+		// Takes every finished query and, with a profiler, records them
+		// as STAGE_GPU. Returns how many finished.
+		int collect(Profiler *profiler);
+	};
+
+}
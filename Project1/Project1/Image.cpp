@@ -0,0 +1,145 @@
+#include "Image.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <mutex>
+
+namespace rme
+{
+
+	static unsigned int crcTable[256];
+	static std::once_flag crcReady;
+
+	static void buildCrcTable()
+	{
+		for (unsigned int n = 0; n < 256; n++)
+		{
+			unsigned int c = n;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			crcTable[n] = c;
+		}
+	}
+
+	static unsigned int crc32(unsigned int crc, const unsigned char* data, size_t length)
+	{
+		// Encoder threads write PNGs side by side, and Visual Studio 2013
+		// has no thread-safe local statics, so the table is built once here
+		std::call_once(crcReady, buildCrcTable);
+		crc = ~crc;
+		for (size_t i = 0; i < length; i++)
+			crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	static void putBE32(std::vector<unsigned char> &out, unsigned int v)
+	{
+		out.push_back((v >> 24) & 0xff);
+		out.push_back((v >> 16) & 0xff);
+		out.push_back((v >> 8) & 0xff);
+		out.push_back(v & 0xff);
+	}
+
+	static void writeChunk(FILE* file, const char* type, const std::vector<unsigned char> &data)
+	{
+		std::vector<unsigned char> chunk;
+		putBE32(chunk, data.size());
+		chunk.insert(chunk.end(), type, type + 4);
+		chunk.insert(chunk.end(), data.begin(), data.end());
+		putBE32(chunk, crc32(0, &chunk[4], chunk.size() - 4));
+		fwrite(&chunk[0], 1, chunk.size(), file);
+	}
+
+	bool writePPM(const char* filename, const unsigned char* rgb, int width, int height)
+	{
+		FILE* file = fopen(filename, "wb");
+		if (!file)
+		{
+			std::printf("Could not open %s for writing\n", filename);
+			return false;
+		}
+		std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+		fwrite(rgb, 1, (size_t)width * height * 3, file);
+		fclose(file);
+		return true;
+	}
+
+	// Uncompressed (stored) deflate keeps the encoder tiny and fast; the files
+	// are about the size of a PPM.
+	bool writePNG(const char* filename, const unsigned char* rgb, int width, int height)
+	{
+		FILE* file = fopen(filename, "wb");
+		if (!file)
+		{
+			std::printf("Could not open %s for writing\n", filename);
+			return false;
+		}
+		static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		fwrite(signature, 1, 8, file);
+
+		std::vector<unsigned char> header;
+		putBE32(header, width);
+		putBE32(header, height);
+		header.push_back(8); // bit depth
+		header.push_back(2); // truecolour
+		header.push_back(0);
+		header.push_back(0);
+		header.push_back(0);
+		writeChunk(file, "IHDR", header);
+
+		// Filter type 0 in front of every row
+		size_t stride = (size_t)width * 3;
+		std::vector<unsigned char> raw;
+		raw.reserve((stride + 1) * height);
+		for (int y = 0; y < height; y++)
+		{
+			raw.push_back(0);
+			raw.insert(raw.end(), rgb + y*stride, rgb + (y + 1)*stride);
+		}
+
+		std::vector<unsigned char> z;
+		z.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+		z.push_back(0x78);
+		z.push_back(0x01);
+		unsigned int a = 1, b = 0;
+		size_t pos = 0;
+		do
+		{
+			size_t block = raw.size() - pos < 65535 ? raw.size() - pos : 65535;
+			z.push_back(pos + block == raw.size() ? 1 : 0);
+			z.push_back(block & 0xff);
+			z.push_back((block >> 8) & 0xff);
+			z.push_back(~block & 0xff);
+			z.push_back((~block >> 8) & 0xff);
+			// 5552 bytes is the longest run that cannot overflow before the modulo
+			for (size_t i = pos; i < pos + block; i += 5552)
+			{
+				size_t end = i + 5552 < pos + block ? i + 5552 : pos + block;
+				for (size_t j = i; j < end; j++)
+				{
+					a += raw[j];
+					b += a;
+				}
+				a %= 65521;
+				b %= 65521;
+			}
+			z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + block);
+			pos += block;
+		} while (pos < raw.size());
+		putBE32(z, (b << 16) | a);
+		writeChunk(file, "IDAT", z);
+
+		writeChunk(file, "IEND", std::vector<unsigned char>());
+		fclose(file);
+		return true;
+	}
+
+	bool writeImage(const char* filename, const unsigned char* rgb, int width, int height)
+	{
+		size_t length = std::strlen(filename);
+		if (length > 4 && (std::strcmp(filename + length - 4, ".png") == 0 || std::strcmp(filename + length - 4, ".PNG") == 0))
+			return writePNG(filename, rgb, width, height);
+		return writePPM(filename, rgb, width, height);
+	}
+
+}
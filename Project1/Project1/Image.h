@@ -0,0 +1,12 @@
+#pragma once
+
+namespace rme
+{
+
+	// 8-bit RGB images, rows stored top to bottom.
+	bool writePPM(const char* filename, const unsigned char* rgb, int width, int height);
+	bool writePNG(const char* filename, const unsigned char* rgb, int width, int height);
+	// Picks PNG or PPM from the file extension
+	bool writeImage(const char* filename, const unsigned char* rgb, int width, int height);
+
+}
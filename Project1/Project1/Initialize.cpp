@@ -1,4 +1,17 @@
 #include "Initialize.h"
+#include "CpuRenderer.h"
+#include "SimClock.h"
+#include "SimThread.h"
+#include "FrameWriter.h"
+#include "CameraPath.h"
+#include <cstring>
+#include <cmath>
+#include <chrono>
+
+extern Controls *control;
+
+// How far -movestatic lifts the basin
+#define BASIN_LIFT 3.0f
 
 float rando(){
 	return static_cast <float> (rand()) / (static_cast <float> (RAND_MAX / 0.01));
@@ -6,11 +19,320 @@ float rando(){
 
 
 
-int main()
+// FNV-1a over every position and velocity, to compare runs bit for bit
+unsigned int stateHash(rme::Scene *scene)
+{
+	unsigned int hash = 2166136261u;
+	rme::ObjectStore &objects = scene->objects;
+	for (int i = 0; i < objects.size(); i++)
+	{
+		const unsigned char *bytes[2] = { (const unsigned char*)&objects.position[i], (const unsigned char*)&objects.velocity[i] };
+		for (int k = 0; k < 2; k++)
+		{
+			for (int b = 0; b < sizeof(glm::vec3); b++)
+			{
+				hash ^= bytes[k][b];
+				hash *= 16777619u;
+			}
+		}
+	}
+	return hash;
+}
+
+// Runs every step of a recorded log as fast as possible
+void replayHeadless(rme::Scene *scene, rme::InputLog &inputLog)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int tick = 0; inputLog.replay(tick, *control); tick++)
+	{
+		scene->update();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	std::printf("replay: %i steps, %.3f ms/step, state %08x\n", inputLog.size(), seconds * 1000.0 / glm::max(inputLog.size(), 1), stateHash(scene));
+}
+
+// Renders frames on the CPU without opening a window and reports throughput
+int renderHeadless(rme::Scene *scene, rme::Camera *camera, const char* output, int frames, int statsMode, rme::ThreadPool *pool)
+{
+	rme::CpuRenderer *cpuRenderer = new rme::CpuRenderer(1200, 720, pool);
+	cpuRenderer->statsMode = statsMode;
+
+	double totalTime = 0.0;
+	for (int i = 0; i < frames; i++)
+	{
+		cpuRenderer->render(scene, camera);
+		totalTime += cpuRenderer->lastRenderTime;
+		std::printf("frame %i: %.2f ms\n", i, cpuRenderer->lastRenderTime * 1000.0);
+	}
+	double pixels = double(cpuRenderer->getWidth()) * cpuRenderer->getHeight() * frames;
+	std::printf("average: %.2f ms/frame, %.2f Mpixel/s\n", totalTime * 1000.0 / frames, pixels / totalTime / 1000000.0);
+	if (statsMode != STATS_OFF) cpuRenderer->stats.report();
+
+	bool saved = cpuRenderer->save(output);
+	delete cpuRenderer;
+	return saved ? 0 : 1;
+}
+
+// The -static arch and basin, built around the origin, then turned and
+// moved in front of the camera. The basin sits lift above the floor.
+rme::StaticSdf *buildStatic(float lift)
+{
+	namespace sdf = rme::sdf;
+	return new rme::StaticSdf(sdf::translate(sdf::rotateY(sdf::unite(
+		sdf::smoothUnion(
+			sdf::translate(sdf::torus(glm::vec2(5.0, 0.8)), glm::vec3(0.0, -2.0, 0.0)),
+			sdf::unite(
+				sdf::translate(sdf::roundBox(glm::vec3(0.6, 6.5, 0.6), 0.2f), glm::vec3(-5.0, -9.5, 0.0)),
+				sdf::translate(sdf::roundBox(glm::vec3(0.6, 6.5, 0.6), 0.2f), glm::vec3(5.0, -9.5, 0.0))),
+			0.8f),
+		sdf::subtract(
+			sdf::translate(sdf::roundBox(glm::vec3(3.0, 1.0, 3.0), 0.2f), glm::vec3(0.0, -15.0 + lift, -6.0)),
+			sdf::translate(sdf::sphere(2.5), glm::vec3(0.0, -13.5 + lift, -6.0)))),
+		0.3f), glm::vec3(0.0, 0.0, 14.0)), glm::vec3(0.85, 0.8, 0.7));
+}
+
+// A box holding the basin anywhere from the floor up to lift
+void basinBounds(float lift, glm::vec3 &lo, glm::vec3 &hi)
+{
+	// Its centre, (0, -15, -6) before the turn by 0.3 about y
+	glm::vec3 centre = glm::vec3(6.0f * std::sin(0.3f), -15.0f, 14.0f - 6.0f * std::cos(0.3f));
+	// 3.2 wide either way, so under 4.6 from the centre however it is turned
+	lo = centre - glm::vec3(4.6f, 1.2f, 4.6f);
+	hi = centre + glm::vec3(4.6f, 1.2f + lift, 4.6f);
+}
+
+// Lifts the basin, rebaking only the cells that reach it, and builds the
+// renderer's shader again around the new field
+void moveStatic(rme::Scene *scene, rme::BrickMap *staticBake, rme::RaymarchRenderer *renderer, rme::ThreadPool *pool)
+{
+	const rme::StaticSdf *old = scene->staticGeometry;
+	scene->staticGeometry = buildStatic(BASIN_LIFT);
+	if (staticBake)
+	{
+		glm::vec3 lo, hi;
+		basinBounds(BASIN_LIFT, lo, hi);
+		int bricks = staticBake->brickCount();
+		int dirty = staticBake->dirtySlots.size();
+		staticBake->rebake(scene->staticGeometry, lo, hi, pool);
+		std::printf("Static rebake: %i bricks, was %i, %i refilled, %.0f ms\n", staticBake->brickCount(), bricks,
+			int(staticBake->dirtySlots.size()) - dirty, staticBake->bakeTime * 1000.0);
+	}
+	if (renderer)
+	{
+		renderer->setStaticGeometry(scene->staticGeometry);
+		renderer->waitForShaders();
+	}
+	delete old;
+}
+
+// Steps the scene at a fixed rate and renders each frame of a clip with no
+// window on screen, fed by a replay log and a camera path if given. Encoder
+// threads write the frames out while later ones render, and GPU frames come
+// back through a ring of pixel buffers, so neither the draw nor the
+// readback waits on the disk.
+// At moveFrame, if any, the basin is lifted.
+int renderSequence(rme::Scene *scene, rme::Camera *camera, rme::BrickMap *staticBake, const char* prefix, int frames, double fps,
+	rme::CameraPath *path, rme::InputLog *replayLog, bool onCpu, bool depthPrepass, int statsMode, int encoders, int moveFrame, rme::ThreadPool *pool)
+{
+	// The path moves the camera through the scene, so it has to be in it
+	if (path && camera->slot < 0)
+	{
+		std::printf("Camera path needs %s in the scene\n", camera->name.c_str());
+		return 1;
+	}
+	const double stepTime = 1.0 / 300.0;
+	int stepsPerFrame = glm::max(1, int(1.0 / (fps * stepTime) + 0.5));
+	rme::RaymarchRenderer *renderer = nullptr;
+	rme::CpuRenderer *cpuRenderer = nullptr;
+	if (onCpu)
+	{
+		cpuRenderer = new rme::CpuRenderer(1200, 720, pool);
+		cpuRenderer->statsMode = statsMode;
+	}
+	else
+	{
+		renderer = new rme::RaymarchRenderer(1200, 720, scene->staticGeometry, staticBake, false);
+		if (!depthPrepass) renderer->conePrepass = false;
+		renderer->enableStats(statsMode);
+		renderer->waitForShaders();
+		renderer->enableReadback();
+	}
+	// Enough queued to ride out a slow write without holding many frames
+	rme::FrameWriter *writer = new rme::FrameWriter(prefix, encoders, 4);
+	std::printf("Sequence: %i frames at %.0f fps, %i steps each, %s\n", frames, fps, stepsPerFrame, onCpu ? "cpu" : "gpu");
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	std::vector<unsigned char> rgb;
+	int width = 0, height = 0;
+	int submitted = 0;
+	long long tick = 0;
+	scene->renderAlpha = 1.0f;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		// The first frame is the starting state
+		for (int step = 0; frame > 0 && step < stepsPerFrame; step++)
+		{
+			// Past the end of the log the controls stay as last recorded
+			if (replayLog) replayLog->replay(tick, *control);
+			scene->update();
+			tick++;
+			if (path)
+			{
+				// Steered by the path, not by its own velocity
+				glm::vec3 position;
+				path->sample(tick * stepTime, position, scene->viewRotation);
+				scene->objects.position[camera->slot] = position;
+				scene->objects.velocity[camera->slot] = glm::vec3(0.0f);
+			}
+		}
+		if (path && frame == 0)
+		{
+			path->sample(0.0, scene->objects.position[camera->slot], scene->viewRotation);
+		}
+		if (frame == moveFrame && scene->staticGeometry) moveStatic(scene, staticBake, renderer, pool);
+
+		if (cpuRenderer)
+		{
+			cpuRenderer->render(scene, camera);
+			width = cpuRenderer->getWidth();
+			height = cpuRenderer->getHeight();
+			rgb.resize(size_t(width) * height * 3);
+			std::memcpy(&rgb[0], cpuRenderer->data(), rgb.size());
+			writer->submit(submitted++, rgb, width, height, false);
+		}
+		else
+		{
+			// Whatever the GPU has already copied back goes to the encoders,
+			// and the oldest is waited for only when the ring is full
+			while (renderer->readFrame(rgb, renderer->pendingFrames() == READBACK_FRAMES))
+			{
+				writer->submit(submitted++, rgb, width, height, true);
+			}
+			renderer->render(scene, camera);
+			glfwGetFramebufferSize(renderer->window, &width, &height);
+		}
+	}
+	while (renderer && renderer->readFrame(rgb, true))
+	{
+		writer->submit(submitted++, rgb, width, height, true);
+	}
+	writer->finish();
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	std::printf("Sequence: %i frames written to %s*.png in %.2f s, %.2f frames/s\n", writer->framesWritten, prefix, seconds, frames / seconds);
+	bool ok = writer->failures == 0 && writer->framesWritten == frames;
+
+	delete writer;
+	delete renderer;
+	delete cpuRenderer;
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
 {
+	// -cpu <image.ppm|image.png> renders headless, -frames tunes it.
+	// -threads sizes the pool shared by the physics step and the CPU renderer.
+	const char* cpuOutput = nullptr;
+	int cpuFrames = 1;
+	int cpuThreads = 0;
+	// -forces exact|bh picks the charge solver, -theta its opening angle and
+	// -forceerror compares it against the exact sum once a second
+	bool useBarnesHut = false;
+	float theta = 0.5;
+	bool reportForceError = false;
+	// -record <file> logs the controls for every step and -replay <file>
+	// feeds them back in, so a run can be repeated exactly
+	const char* recordFile = nullptr;
+	const char* replayFile = nullptr;
+	// -profile <file.csv|file.json> saves every stage timing of the run,
+	// as rows or as a Chrome trace
+	const char* profileFile = nullptr;
+	// -static adds an arch and a basin to the room as fixed geometry,
+	// baked into a brick map unless -nobake asks for the exact field
+	bool addStatic = false;
+	bool bakeStatic = true;
+	// -movestatic <frame> lifts the basin at that frame of a -sequence
+	int moveFrame = -1;
+	// -budget <ms> lowers the resolution to keep the march within that much GPU time
+	double frameBudget = 0.0;
+	// -noprepass starts every ray at the camera, to compare against the depth prepass
+	bool depthPrepass = true;
+	// -reproject starts rays at the surfaces they hit last frame
+	bool reproject = false;
+	// -load <file> starts from a snapshot instead of the scene built below,
+	// -save <file> writes one on exit and -checkpoint <steps> also every
+	// that many steps, so a long run can be resumed
+	const char* loadFile = nullptr;
+	const char* saveFile = nullptr;
+	int checkpointSteps = 0;
+	// -warps <pairs> links that many pairs of launched spheres as warps
+	int warpPairs = 1;
+	// -sequence <prefix> renders -frames frames of a clip offline to
+	// numbered PNGs, -fps frames per simulated second, on the GPU unless
+	// -sequencecpu is given. -path <file> scripts the camera, -replay
+	// scripts the controls and -encoders sets how many threads write.
+	const char* sequencePrefix = nullptr;
+	bool sequenceCpu = false;
+	double sequenceFps = 30.0;
+	const char* pathFile = nullptr;
+	int encoders = 2;
+	// -stats steps|marches|objects tints every pixel by that part of what
+	// its march cost, and reports the frame's totals and percentiles
+	int statsMode = STATS_OFF;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "-cpu") == 0 && i + 1 < argc) cpuOutput = argv[++i];
+		else if (std::strcmp(argv[i], "-frames") == 0 && i + 1 < argc) cpuFrames = atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) cpuThreads = atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "-forces") == 0 && i + 1 < argc) useBarnesHut = std::strcmp(argv[++i], "bh") == 0;
+		else if (std::strcmp(argv[i], "-theta") == 0 && i + 1 < argc) theta = (float)atof(argv[++i]);
+		else if (std::strcmp(argv[i], "-forceerror") == 0) reportForceError = true;
+		else if (std::strcmp(argv[i], "-record") == 0 && i + 1 < argc) recordFile = argv[++i];
+		else if (std::strcmp(argv[i], "-replay") == 0 && i + 1 < argc) replayFile = argv[++i];
+		else if (std::strcmp(argv[i], "-profile") == 0 && i + 1 < argc) profileFile = argv[++i];
+		else if (std::strcmp(argv[i], "-static") == 0) addStatic = true;
+		else if (std::strcmp(argv[i], "-nobake") == 0) bakeStatic = false;
+		else if (std::strcmp(argv[i], "-movestatic") == 0 && i + 1 < argc) moveFrame = atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "-noprepass") == 0) depthPrepass = false;
+		else if (std::strcmp(argv[i], "-reproject") == 0) reproject = true;
+		else if (std::strcmp(argv[i], "-load") == 0 && i + 1 < argc) loadFile = argv[++i];
+		else if (std::strcmp(argv[i], "-save") == 0 && i + 1 < argc) saveFile = argv[++i];
+		else if (std::strcmp(argv[i], "-checkpoint") == 0 && i + 1 < argc) checkpointSteps = atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "-warps") == 0 && i + 1 < argc) warpPairs = atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "-sequence") == 0 && i + 1 < argc) sequencePrefix = argv[++i];
+		else if (std::strcmp(argv[i], "-sequencecpu") == 0) sequenceCpu = true;
+		else if (std::strcmp(argv[i], "-fps") == 0 && i + 1 < argc) sequenceFps = atof(argv[++i]);
+		else if (std::strcmp(argv[i], "-path") == 0 && i + 1 < argc) pathFile = argv[++i];
+		else if (std::strcmp(argv[i], "-encoders") == 0 && i + 1 < argc) encoders = atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "-stats") == 0 && i + 1 < argc)
+		{
+			const char* name = argv[++i];
+			statsMode = rme::statsModeFromName(name);
+			if (statsMode < 0)
+			{
+				std::printf("Unknown -stats mode %s, use steps, marches or objects\n", name);
+				return 1;
+			}
+		}
+		else if (std::strcmp(argv[i], "-budget") == 0 && i + 1 < argc) frameBudget = atof(argv[++i]) / 1000.0;
+		else if (std::strcmp(argv[i], "-simd") == 0 && i + 1 < argc)
+		{
+			// Caps the SDF packet kernels at scalar, sse or avx2
+			const char* level = argv[++i];
+			rme::setSimdLevel(std::strcmp(level, "avx2") == 0 ? rme::SIMD_AVX2 : std::strcmp(level, "sse") == 0 ? rme::SIMD_SSE : rme::SIMD_SCALAR);
+		}
+	}
+	std::printf("SIMD: %s\n", rme::simdLevelName(rme::getSimdLevel()));
+
 	srand(0);
 
+	rme::ThreadPool *pool = new rme::ThreadPool(cpuThreads);
+	std::printf("Threads: %i\n", pool->size());
+
 	rme::Scene *scene = new rme::Scene();
+	scene->pool = pool;
+	scene->forceSolver = useBarnesHut ? rme::FORCE_BARNES_HUT : rme::FORCE_EXACT;
+	scene->theta = theta;
+	scene->launchWarps = warpPairs;
 
 	rme::Camera *camera = new rme::Camera(std::string("camera1"));
 	camera->position = glm::vec3(0.0, 2.0, -3.0);
@@ -37,7 +359,56 @@ int main()
 	room->shape = glm::vec3(30.0, 16.0, 36.0);
 	scene->add(room);
 
-	rme::RaymarchRenderer *renderer = new rme::RaymarchRenderer(1200, 720);
+	rme::BrickMap *staticBake = nullptr;
+	if (addStatic)
+	{
+		scene->staticGeometry = buildStatic(0.0f);
+		if (bakeStatic)
+		{
+			// Over the room, with a band as wide as the camera, the largest
+			// thing that collides with it
+			staticBake = new rme::BrickMap(scene->staticGeometry, -room->shape, room->shape, 0.25f, 4.0f);
+			staticBake->bake(pool);
+			scene->staticBake = staticBake;
+			std::printf("Static bake: %i bricks of %i cells, %.1f MB, %.0f ms\n", staticBake->brickCount(), int(staticBake->slotOf.size()),
+				staticBake->samples.size() * sizeof(float) / 1048576.0, staticBake->bakeTime * 1000.0);
+		}
+	}
+
+	// Fixed geometry is code, not part of a snapshot, so -static still applies
+	long long startTick = 0;
+	if (loadFile)
+	{
+		if (!scene->loadSnapshot(loadFile, startTick)) return 1;
+		if (!scene->attach(camera)) std::printf("Snapshot %s has no %s\n", loadFile, camera->name.c_str());
+		std::printf("Loaded %i objects at step %lli\n", scene->objects.size(), startTick);
+	}
+
+	rme::InputLog inputLog;
+	if (replayFile && !inputLog.load(replayFile)) return 1;
+
+	if (sequencePrefix)
+	{
+		rme::CameraPath path;
+		if (pathFile && !path.load(pathFile)) return 1;
+		return renderSequence(scene, camera, staticBake, sequencePrefix, cpuFrames > 0 ? cpuFrames : 1, sequenceFps > 0.0 ? sequenceFps : 30.0,
+			pathFile ? &path : nullptr, replayFile ? &inputLog : nullptr, sequenceCpu, depthPrepass, statsMode, encoders, moveFrame, pool);
+	}
+
+	if (cpuOutput)
+	{
+		if (replayFile) replayHeadless(scene, inputLog);
+		if (saveFile && !scene->saveSnapshot(saveFile, startTick + (replayFile ? inputLog.size() : 0))) return 1;
+		return renderHeadless(scene, camera, cpuOutput, cpuFrames > 0 ? cpuFrames : 1, statsMode, pool);
+	}
+
+	rme::RaymarchRenderer *renderer = new rme::RaymarchRenderer(1200, 720, scene->staticGeometry, staticBake);
+	rme::Profiler *profiler = new rme::Profiler(profileFile != nullptr);
+	renderer->profiler = profiler;
+	if (frameBudget > 0.0) renderer->setFrameBudget(frameBudget);
+	if (!depthPrepass) renderer->conePrepass = false;
+	if (reproject) renderer->enableReprojection();
+	renderer->enableStats(statsMode);
 	
 	int totalFrames = 0;
 	int lastFrame = 0;
@@ -45,19 +416,33 @@ int main()
 	float lastTime = 0.0;
 	//glfwSetTime(0.0);
 
+	// The step constants (gravity, damping, launch speed) were tuned at
+	// 5 steps per 60Hz frame, so the clock keeps that rate. The scene is
+	// only touched by the simulation thread until it is stopped; this one
+	// draws the frames it publishes.
+	rme::SimThread *sim = new rme::SimThread(scene, camera, 1.0 / 300.0, profiler);
+	if (replayFile) sim->replayLog = &inputLog;
+	else if (recordFile) sim->recordLog = &inputLog;
+	if (saveFile) sim->checkpointFile = saveFile;
+	sim->checkpointSteps = checkpointSteps;
+	sim->startTick = startTick;
+	sim->measureForceError = reportForceError && scene->forceSolver == rme::FORCE_BARNES_HUT;
+	sim->start();
+	bool replayDone = false;
+
 	// Game loop
 	
-	while (!glfwWindowShouldClose(renderer->window))
+	while (!glfwWindowShouldClose(renderer->window) && !replayDone)
 	{
 		
 	//	s1->position.z += 0.002;
 
-		for (int i = 0; i < 5; i++)
-		{
-			scene->update();
-		}
+		profiler->beginFrame();
+		replayDone = sim->finished();
+		rme::SceneFrame *frame = sim->latest();
 
-		renderer->render(scene, camera);
+		renderer->render(frame->scene, frame->camera);
+		profiler->drain();
 
 		totalFrames++;
 		totalTime = float(glfwGetTime());
@@ -65,12 +450,41 @@ int main()
 		if (delta > 1.0)
 		{
 			std::printf("FPS: %f\n", float(totalFrames - lastFrame)/delta);
+			if (frameBudget > 0.0) std::printf("Resolution: %.0f%%\n", renderer->getResolutionScale() * 100.0f);
+			rme::ForceStats &forces = frame->scene->forceStats;
+			std::printf("Forces: %s, %i bodies, build %.3f ms, solve %.3f ms\n", scene->forceSolver == rme::FORCE_BARNES_HUT ? "barnes-hut" : "exact",
+				forces.bodies, forces.buildTime * 1000.0, forces.solveTime * 1000.0);
+			profiler->report();
+			if (statsMode != STATS_OFF)
+			{
+				renderer->stats.report();
+				if (renderer->statsSkipped > 0) std::printf("Cost: %i frames not finished when read, left out\n", renderer->statsSkipped);
+			}
+			if (sim->measureForceError)
+			{
+				std::printf("Force error (theta %.2f): rms %f, max %f\n", scene->theta, forces.rmsError, forces.maxError);
+			}
 			lastFrame = totalFrames;
 			lastTime = totalTime;
 		}
 
 	}
+	sim->stop();
+
+	if (replayFile) std::printf("replay: %i steps, state %08x\n", inputLog.size(), stateHash(scene));
+	if (recordFile)
+	{
+		std::printf("recorded: %i steps, state %08x\n", inputLog.size(), stateHash(scene));
+		inputLog.save(recordFile);
+	}
+
+	if (saveFile) scene->saveSnapshot(saveFile, startTick + sim->stepsRun);
+
+	profiler->summary();
+	if (profileFile) profiler->save(profileFile);
 
+	delete sim;
 	delete renderer;
+	delete profiler;
 	return 0;
 }
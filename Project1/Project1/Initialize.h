@@ -1,3 +1,3 @@
 
-#include "rme.h"
+#include "RaymarchRenderer.h"
 #include <stdlib.h>
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "MappedFile.h"
+#include <cstdio>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace rme
+{
+
+#ifdef _WIN32
+
+	MappedFile::MappedFile()
+	{
+		bytes = nullptr;
+		length = 0;
+		file = INVALID_HANDLE_VALUE;
+		mapping = nullptr;
+	}
+
+	bool MappedFile::open(const char* filename)
+	{
+		close();
+		file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER fileSize;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			std::printf("Could not open %s\n", filename);
+			close();
+			return false;
+		}
+		length = (size_t)fileSize.QuadPart;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) bytes = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!bytes)
+		{
+			std::printf("Could not map %s\n", filename);
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		if (bytes) UnmapViewOfFile(bytes);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		bytes = nullptr;
+		length = 0;
+		file = INVALID_HANDLE_VALUE;
+		mapping = nullptr;
+	}
+
+#else
+
+	MappedFile::MappedFile()
+	{
+		bytes = nullptr;
+		length = 0;
+		descriptor = -1;
+	}
+
+	bool MappedFile::open(const char* filename)
+	{
+		close();
+		descriptor = ::open(filename, O_RDONLY);
+		struct stat info;
+		if (descriptor < 0 || fstat(descriptor, &info) != 0 || info.st_size == 0)
+		{
+			std::printf("Could not open %s\n", filename);
+			close();
+			return false;
+		}
+		length = (size_t)info.st_size;
+		void *view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (view == MAP_FAILED)
+		{
+			std::printf("Could not map %s\n", filename);
+			close();
+			return false;
+		}
+		bytes = (const unsigned char*)view;
+		// Loading reads every section front to back
+		madvise(view, length, MADV_SEQUENTIAL);
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		if (bytes) munmap((void*)bytes, length);
+		if (descriptor >= 0) ::close(descriptor);
+		bytes = nullptr;
+		length = 0;
+		descriptor = -1;
+	}
+
+#endif
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	const unsigned char* MappedFile::data() const
+	{
+		return bytes;
+	}
+
+	size_t MappedFile::size() const
+	{
+		return length;
+	}
+
+}
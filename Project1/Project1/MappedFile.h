@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+
+namespace rme
+{
+
+	// A whole file mapped read only, so its pages are only read in as they
+	// are touched and loading copies straight out of the page cache
+	class MappedFile
+	{
+		const unsigned char *bytes;
+		size_t length;
+#ifdef _WIN32
+		void *file;
+		void *mapping;
+#else
+		int descriptor;
+#endif
+
+	public:
+		MappedFile();
+		~MappedFile();
+		// Closes whatever was open first. False, with a message, if the
+		// file cannot be read or is empty.
+		bool open(const char* filename);
+		void close();
+		const unsigned char* data() const;
+		size_t size() const;
+	};
+
+}
@@ -0,0 +1,249 @@
+#include "ObjectBuffer.h"
+#include "rme.h"
+#include <cstring>
+
+namespace rme
+{
+
+	ObjectBuffer::ObjectBuffer(int c, GLuint b)
+	{
+		binding = b;
+		region = 0;
+		written = 0;
+		lastCount = -1;
+		mapped = nullptr;
+		buffer = 0;
+		capacity = 0;
+
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		persistent = major > 4 || (major == 4 && minor >= 4);
+
+		// Bound ranges have to start on the driver's offset alignment
+		alignment = 256;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+		allocate(glm::max(c, 1));
+
+		glGenBuffers(1, &gridBuffer);
+		gridCapacity = 0;
+	}
+
+	ObjectBuffer::~ObjectBuffer()
+	{
+		release();
+		glDeleteBuffers(1, &gridBuffer);
+	}
+
+	void ObjectBuffer::allocate(int c)
+	{
+		capacity = c;
+		regionSize = capacity * sizeof(GpuObject);
+		regionSize = (regionSize + alignment - 1) / alignment * alignment;
+		regionCount = persistent ? 3 : 1;
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		if (persistent)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_SHADER_STORAGE_BUFFER, regionSize * regionCount, nullptr, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, regionSize * regionCount, flags);
+			if (!mapped)
+			{
+				std::cout << "Persistent mapping failed, using glBufferSubData\n";
+				glDeleteBuffers(1, &buffer);
+				glGenBuffers(1, &buffer);
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+				persistent = false;
+				regionCount = 1;
+			}
+		}
+		if (!persistent)
+		{
+			glBufferData(GL_SHADER_STORAGE_BUFFER, regionSize, nullptr, GL_DYNAMIC_DRAW);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		// A geometry no object has makes every slot dirty on first use
+		GpuObject unused;
+		std::memset(&unused, 0, sizeof(unused));
+		unused.geometry = -1;
+		fences.assign(regionCount, (GLsync)0);
+		shadows.assign(regionCount, std::vector<GpuObject>(capacity, unused));
+	}
+
+	// Waits however long the GPU takes: a region written before it is done
+	// reading is a race whatever the reason it is late. Only the first wait
+	// flushes. False when the wait failed and the region's state is unknown.
+	static bool waitForFence(GLsync fence)
+	{
+		GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+		for (;;)
+		{
+			GLenum status = glClientWaitSync(fence, flags, 1000000000);
+			if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) return true;
+			if (status == GL_WAIT_FAILED)
+			{
+				std::cout << "Waiting for an object buffer fence failed\n";
+				return false;
+			}
+			flags = 0;
+		}
+	}
+
+	void ObjectBuffer::release()
+	{
+		for (int r = 0; r < fences.size(); r++)
+		{
+			if (!fences[r]) continue;
+			waitForFence(fences[r]);
+			glDeleteSync(fences[r]);
+			fences[r] = 0;
+		}
+		if (mapped)
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+			glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			mapped = nullptr;
+		}
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+
+	bool ObjectBuffer::isPersistent()
+	{
+		return persistent;
+	}
+
+	void ObjectBuffer::pack(Scene *scene, int count)
+	{
+		ObjectStore &objects = scene->objects;
+		packed.resize(count);
+		for (int i = 0; i < count; i++)
+		{
+			GpuObject &gpu = packed[i];
+			glm::vec3 position = scene->renderPosition(i);
+			gpu.position[0] = position.x;
+			gpu.position[1] = position.y;
+			gpu.position[2] = position.z;
+			gpu.radius = objects.radius[i];
+			gpu.direction[0] = objects.direction[i].x;
+			gpu.direction[1] = objects.direction[i].y;
+			gpu.direction[2] = objects.direction[i].z;
+			// Only spheres are coloured by age; leaving it out elsewhere
+			// keeps rooms from going dirty every step
+			gpu.age = objects.geometry[i] == SPHERE ? objects.age[i] : 0.0f;
+			gpu.shape[0] = objects.shape[i].x;
+			gpu.shape[1] = objects.shape[i].y;
+			gpu.shape[2] = objects.shape[i].z;
+			gpu.geometry = objects.geometry[i];
+			gpu.color[0] = objects.color[i].x;
+			gpu.color[1] = objects.color[i].y;
+			gpu.color[2] = objects.color[i].z;
+			gpu.mass = objects.mass[i];
+		}
+	}
+
+	void ObjectBuffer::upload(Scene *scene)
+	{
+		int count = scene->objects.size();
+		if (count > capacity)
+		{
+			// Twice what is needed, so a stream of spawns reallocates rarely
+			release();
+			allocate(2 * count);
+		}
+		pack(scene, count);
+
+		int next = (region + 1) % regionCount;
+		if (persistent && fences[next])
+		{
+			// The GPU may still be reading this region from regionCount
+			// frames ago. If that cannot be known, the region is left alone
+			// and the last one stays bound, to be tried again next frame.
+			if (!waitForFence(fences[next]))
+			{
+				written = 0;
+				return;
+			}
+			glDeleteSync(fences[next]);
+			fences[next] = 0;
+		}
+		region = next;
+		std::vector<GpuObject> &shadow = shadows[region];
+		GLintptr offset = region * regionSize;
+
+		written = 0;
+		int first = count, last = -1;
+		for (int i = 0; i < count; i++)
+		{
+			if (std::memcmp(&packed[i], &shadow[i], sizeof(GpuObject)) == 0) continue;
+			shadow[i] = packed[i];
+			written++;
+			if (persistent) std::memcpy(mapped + offset + i * sizeof(GpuObject), &packed[i], sizeof(GpuObject));
+			first = glm::min(first, i);
+			last = i;
+		}
+
+		if (!persistent && last >= first)
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(GpuObject), (last - first + 1) * sizeof(GpuObject), &packed[first]);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		}
+
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, offset, regionSize);
+
+		// Regions hold the same objects, so a write to any of them means the
+		// scene changed since the grid was built
+		if (written > 0 || count != lastCount)
+		{
+			grid.build(scene);
+			uploadGrid();
+			lastCount = count;
+		}
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding + 1, gridBuffer);
+	}
+
+	void ObjectBuffer::uploadGrid()
+	{
+		GpuGridHeader header;
+		header.origin[0] = grid.origin.x;
+		header.origin[1] = grid.origin.y;
+		header.origin[2] = grid.origin.z;
+		header.cellSize = grid.cellSize;
+		header.dims[0] = grid.dims.x;
+		header.dims[1] = grid.dims.y;
+		header.dims[2] = grid.dims.z;
+		header.margin = grid.margin;
+		header.cellCount = grid.cellCount();
+		header.objectsOffset = grid.cells.size();
+		header.globalOffset = header.objectsOffset + grid.cellObjects.size();
+		header.globalCount = grid.global.size();
+
+		gridData.resize(sizeof(header) / sizeof(int));
+		std::memcpy(&gridData[0], &header, sizeof(header));
+		gridData.insert(gridData.end(), grid.cells.begin(), grid.cells.end());
+		gridData.insert(gridData.end(), grid.cellObjects.begin(), grid.cellObjects.end());
+		gridData.insert(gridData.end(), grid.global.begin(), grid.global.end());
+
+		// Orphaned each time, the driver hands back storage not in use
+		GLsizeiptr size = gridData.size() * sizeof(int);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+		if (size > gridCapacity) gridCapacity = 2 * size;
+		glBufferData(GL_SHADER_STORAGE_BUFFER, gridCapacity, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, &gridData[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	void ObjectBuffer::fence()
+	{
+		if (!persistent) return;
+		if (fences[region]) glDeleteSync(fences[region]);
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+}
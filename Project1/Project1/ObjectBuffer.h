@@ -0,0 +1,83 @@
+#pragma once
+#include <vector>
+#include <GL/glew.h>
+#include "SceneGrid.h"
+
+namespace rme
+{
+
+	class Scene;
+
+	// One object as march.frag's std430 Object3D sees it. Every vec3 is
+	// followed by a scalar so the struct packs into four vec4s.
+	struct GpuObject
+	{
+		float position[3];
+		float radius;
+		float direction[3];
+		float age;
+		float shape[3];
+		int geometry;
+		float color[3];
+		float mass;
+	};
+
+	// Fixed part of march.frag's GridBlock, followed by SceneGrid::cells,
+	// cellObjects and global as one int array
+	struct GpuGridHeader
+	{
+		float origin[3];
+		float cellSize;
+		int dims[3];
+		float margin;
+		int objectsOffset;   // into the int array
+		int globalOffset;
+		int globalCount;
+		int cellCount;
+	};
+
+	// Shader storage buffers holding the objects of march.frag and the grid
+	// over them, grown as the scene grows. With GL 4.4 the object buffer is
+	// persistently mapped and split into a ring of regions, each fenced
+	// after the draw that reads it, so the CPU never waits on a frame still
+	// in flight. Each region keeps a copy of what it last held and only
+	// objects that differ from it are written. Older contexts fall back to
+	// glBufferSubData over the range that changed. The grid is rebuilt and
+	// re-sent only on frames where some object changed.
+	class ObjectBuffer
+	{
+		GLuint buffer;
+		GLuint binding;
+		int capacity;
+		int regionCount;
+		GLsizeiptr regionSize;
+		GLint alignment;
+		int region;
+		bool persistent;
+		unsigned char *mapped;
+		std::vector<GLsync> fences;
+		std::vector<std::vector<GpuObject> > shadows;
+		std::vector<GpuObject> packed;
+		int lastCount;
+		GLuint gridBuffer;
+		GLsizeiptr gridCapacity;
+		std::vector<int> gridData;
+		void allocate(int capacity);
+		void release();
+		void pack(Scene *scene, int count);
+		void uploadGrid();
+
+	public:
+		int written; // objects written by the last upload
+		SceneGrid grid;
+		// Objects go to binding, the grid to binding + 1
+		ObjectBuffer(int capacity, GLuint binding);
+		~ObjectBuffer();
+		bool isPersistent();
+		// Writes the scene's objects and grid and binds them
+		void upload(Scene *scene);
+		// Call once the draw reading the last upload has been issued
+		void fence();
+	};
+
+}
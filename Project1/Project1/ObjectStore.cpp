@@ -0,0 +1,291 @@
+#include "rme.h"
+
+namespace rme
+{
+
+	ObjectStore::ObjectStore()
+	{
+		for (int g = 0; g <= GEOMETRY_TYPES; g++) groupStart[g] = 0;
+		movedCount = 0;
+	}
+
+	int ObjectStore::size()
+	{
+		return position.size();
+	}
+
+	int ObjectStore::groupBegin(int g)
+	{
+		return groupStart[g];
+	}
+
+	int ObjectStore::groupEnd(int g)
+	{
+		return groupStart[g + 1];
+	}
+
+	void ObjectStore::pushFields()
+	{
+		position.push_back(glm::vec3(0.0));
+		velocity.push_back(glm::vec3(0.0));
+		correction.push_back(glm::vec3(0.0));
+		direction.push_back(glm::vec3(0.0));
+		shape.push_back(glm::vec3(0.0));
+		color.push_back(glm::vec3(0.0));
+		radius.push_back(0.0f);
+		mass.push_back(0.0f);
+		charge.push_back(0.0f);
+		age.push_back(0.0f);
+		geometry.push_back(0);
+		collisions.push_back(0);
+		physics.push_back(0);
+		name.push_back(std::string());
+		owner.push_back(nullptr);
+		id.push_back(-1);
+	}
+
+	void ObjectStore::popFields()
+	{
+		position.pop_back();
+		velocity.pop_back();
+		correction.pop_back();
+		direction.pop_back();
+		shape.pop_back();
+		color.pop_back();
+		radius.pop_back();
+		mass.pop_back();
+		charge.pop_back();
+		age.pop_back();
+		geometry.pop_back();
+		collisions.pop_back();
+		physics.pop_back();
+		name.pop_back();
+		owner.pop_back();
+		id.pop_back();
+	}
+
+	// to is free, so the name is swapped rather than copied
+	void ObjectStore::moveFields(int from, int to)
+	{
+		position[to] = position[from];
+		velocity[to] = velocity[from];
+		correction[to] = correction[from];
+		direction[to] = direction[from];
+		shape[to] = shape[from];
+		color[to] = color[from];
+		radius[to] = radius[from];
+		mass[to] = mass[from];
+		charge[to] = charge[from];
+		age[to] = age[from];
+		geometry[to] = geometry[from];
+		collisions[to] = collisions[from];
+		physics[to] = physics[from];
+		name[to].swap(name[from]);
+		owner[to] = owner[from];
+		id[to] = id[from];
+		indexOfId[id[to]] = to;
+		if (owner[to]) owner[to]->slot = to;
+		moved[movedCount++] = to;
+	}
+
+	int ObjectStore::add(const Object3D &desc, Object3D *obj)
+	{
+		int g = glm::clamp(desc.geometry, 0, GEOMETRY_TYPES - 1);
+		movedCount = 0;
+		pushFields();
+		// Each later group hands its first object to the free place just
+		// past its end, which frees a place at the end of the group before
+		int index = size() - 1;
+		for (int h = GEOMETRY_TYPES - 1; h > g; h--)
+		{
+			if (groupStart[h] < index) moveFields(groupStart[h], index);
+			index = groupStart[h];
+			groupStart[h]++;
+		}
+		groupStart[GEOMETRY_TYPES]++;
+
+		write(index, desc);
+		geometry[index] = g;
+		name[index] = desc.name;
+		owner[index] = obj;
+		if (obj) obj->slot = index;
+
+		int newId;
+		if (!freeIds.empty())
+		{
+			newId = freeIds.back();
+			freeIds.pop_back();
+		}
+		else
+		{
+			newId = indexOfId.size();
+			indexOfId.push_back(-1);
+			generationOfId.push_back(0);
+		}
+		indexOfId[newId] = index;
+		id[index] = newId;
+		if (!desc.name.empty())
+		{
+			std::unordered_map<std::string, NameEntry>::iterator entry = named.find(desc.name);
+			if (entry == named.end())
+			{
+				NameEntry first = { newId, 1 };
+				named[desc.name] = first;
+			}
+			else entry->second.count++;
+		}
+		moved[movedCount++] = index;
+		return index;
+	}
+
+	void ObjectStore::erase(int index)
+	{
+		int g = geometry[index];
+		movedCount = 0;
+		if (owner[index]) owner[index]->slot = -1;
+		int gone = id[index];
+		indexOfId[gone] = -1;
+		generationOfId[gone]++;
+		freeIds.push_back(gone);
+
+		if (!name[index].empty())
+		{
+			std::unordered_map<std::string, NameEntry>::iterator entry = named.find(name[index]);
+			if (--entry->second.count == 0) named.erase(entry);
+			else if (entry->second.id == gone)
+			{
+				// Only objects sharing a name pay for a search
+				for (int i = 0; i < size(); i++)
+				{
+					if (i != index && name[i] == name[index])
+					{
+						entry->second.id = id[i];
+						break;
+					}
+				}
+			}
+		}
+
+		// The last object of the group fills the hole, the last of the next
+		// group fills the place that leaves, and so on to the end
+		int hole = index;
+		for (int h = g; h < GEOMETRY_TYPES; h++)
+		{
+			int last = groupStart[h + 1] - 1;
+			if (last != hole) moveFields(last, hole);
+			hole = last;
+			groupStart[h + 1]--;
+		}
+		popFields();
+		moved[movedCount++] = hole;
+	}
+
+	int ObjectStore::find(const std::string &n)
+	{
+		std::unordered_map<std::string, NameEntry>::iterator entry = named.find(n);
+		return entry == named.end() ? -1 : indexOfId[entry->second.id];
+	}
+
+	ObjectHandle ObjectStore::handle(int index)
+	{
+		ObjectHandle h = { id[index], generationOfId[id[index]] };
+		return h;
+	}
+
+	int ObjectStore::indexOf(ObjectHandle h)
+	{
+		if (h.id < 0 || h.id >= indexOfId.size() || generationOfId[h.id] != h.generation) return -1;
+		return indexOfId[h.id];
+	}
+
+	const std::vector<unsigned int>& ObjectStore::generations()
+	{
+		return generationOfId;
+	}
+
+	const std::vector<int>& ObjectStore::freeHandles()
+	{
+		return freeIds;
+	}
+
+	void ObjectStore::restore(const int* groups, const unsigned int* generations, int idCount, const int* freeList, int freeCount)
+	{
+		for (int i = 0; i < owner.size(); i++)
+		{
+			if (owner[i]) owner[i]->slot = -1;
+		}
+		owner.assign(size(), nullptr);
+		for (int g = 0; g <= GEOMETRY_TYPES; g++) groupStart[g] = groups[g];
+
+		generationOfId.assign(generations, generations + idCount);
+		indexOfId.assign(idCount, -1);
+		for (int i = 0; i < size(); i++) indexOfId[id[i]] = i;
+		freeIds.assign(freeList, freeList + freeCount);
+
+		// Which of several objects sharing a name was added first is not
+		// kept, so find() returns the first in store order
+		named.clear();
+		named.reserve(size());
+		for (int i = 0; i < size(); i++)
+		{
+			if (name[i].empty()) continue;
+			std::unordered_map<std::string, NameEntry>::iterator entry = named.find(name[i]);
+			if (entry == named.end())
+			{
+				NameEntry first = { id[i], 1 };
+				named[name[i]] = first;
+			}
+			else entry->second.count++;
+		}
+		movedCount = 0;
+	}
+
+	void ObjectStore::copyDrawn(const ObjectStore &from)
+	{
+		for (int g = 0; g <= GEOMETRY_TYPES; g++) groupStart[g] = from.groupStart[g];
+		position = from.position;
+		direction = from.direction;
+		shape = from.shape;
+		color = from.color;
+		radius = from.radius;
+		mass = from.mass;
+		age = from.age;
+		geometry = from.geometry;
+	}
+
+	void ObjectStore::read(int index, Object3D &out)
+	{
+		out.position = position[index];
+		out.velocity = velocity[index];
+		out.correction = correction[index];
+		out.direction = direction[index];
+		out.shape = shape[index];
+		out.color = color[index];
+		out.radius = radius[index];
+		out.mass = mass[index];
+		out.charge = charge[index];
+		out.age = age[index];
+		out.geometry = geometry[index];
+		out.collisions = collisions[index] != 0;
+		out.physics = physics[index] != 0;
+		out.name = name[index];
+	}
+
+	void ObjectStore::write(int index, const Object3D &desc)
+	{
+		// Geometry and name decide placement and lookup, so they stay as added
+		position[index] = desc.position;
+		velocity[index] = desc.velocity;
+		correction[index] = desc.correction;
+		direction[index] = desc.direction;
+		shape[index] = desc.shape;
+		color[index] = desc.color;
+		radius[index] = desc.radius;
+		mass[index] = desc.mass;
+		charge[index] = desc.charge;
+		age[index] = desc.age;
+		collisions[index] = desc.collisions;
+		physics[index] = desc.physics;
+	}
+
+}
@@ -0,0 +1,237 @@
+#include "Profiler.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+namespace rme
+{
+
+	static const char* stageNames[PROFILE_STAGES] = { "poll", "update", "uniforms", "draw", "swap", "gpu" };
+
+	const char* stageName(int stage)
+	{
+		return stage >= 0 && stage < PROFILE_STAGES ? stageNames[stage] : "unknown";
+	}
+
+	SampleRing::SampleRing(int capacity)
+	{
+		unsigned int size = 1;
+		while (size < (unsigned int)capacity) size *= 2;
+		slots.resize(size);
+		mask = size - 1;
+		head = 0;
+		tail = 0;
+		dropped = 0;
+	}
+
+	bool SampleRing::push(const ProfileSample &sample)
+	{
+		unsigned int h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) > mask)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		slots[h & mask] = sample;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool SampleRing::pop(ProfileSample &sample)
+	{
+		unsigned int t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire)) return false;
+		sample = slots[t & mask];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	#define HISTOGRAM_STEPS 16
+	#define HISTOGRAM_BUCKETS (HISTOGRAM_STEPS * 34)
+
+	LatencyHistogram::LatencyHistogram()
+	{
+		buckets.assign(HISTOGRAM_BUCKETS, 0);
+		clear();
+	}
+
+	void LatencyHistogram::add(double seconds)
+	{
+		double nanos = seconds * 1000000000.0;
+		int bucket = nanos > 1.0 ? int(std::log2(nanos) * HISTOGRAM_STEPS) : 0;
+		if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS - 1;
+		buckets[bucket]++;
+		count++;
+		total += seconds;
+		if (seconds > longest) longest = seconds;
+	}
+
+	void LatencyHistogram::clear()
+	{
+		std::fill(buckets.begin(), buckets.end(), 0);
+		count = 0;
+		total = 0.0;
+		longest = 0.0;
+	}
+
+	double LatencyHistogram::percentile(double p)
+	{
+		if (count == 0) return 0.0;
+		int rank = int(std::ceil(p * count));
+		if (rank < 1) rank = 1;
+		int seen = 0;
+		for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+		{
+			seen += buckets[b];
+			if (seen < rank) continue;
+			// Middle of the bucket, never past the longest sample
+			double nanos = std::pow(2.0, (b + 0.5) / HISTOGRAM_STEPS);
+			double seconds = nanos / 1000000000.0;
+			return seconds < longest ? seconds : longest;
+		}
+		return longest;
+	}
+
+	double LatencyHistogram::mean()
+	{
+		return count > 0 ? total / count : 0.0;
+	}
+
+	Profiler::Profiler(bool keep)
+	{
+		epoch = std::chrono::high_resolution_clock::now();
+		frame = 0;
+		keepHistory = keep;
+		// Drained every frame, so this only has to cover a few long ones
+		for (int s = 0; s < PROFILE_STAGES; s++) rings.push_back(new SampleRing(4096));
+	}
+
+	Profiler::~Profiler()
+	{
+		for (int s = 0; s < rings.size(); s++) delete rings[s];
+	}
+
+	double Profiler::now()
+	{
+		return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - epoch).count();
+	}
+
+	void Profiler::beginFrame()
+	{
+		frame.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void Profiler::record(int stage, double start, double duration)
+	{
+		record(stage, frame.load(std::memory_order_relaxed), start, duration);
+	}
+
+	void Profiler::record(int stage, long long f, double start, double duration)
+	{
+		ProfileSample sample;
+		sample.frame = f;
+		sample.start = start;
+		sample.duration = duration;
+		sample.stage = stage;
+		rings[stage]->push(sample);
+	}
+
+	double Profiler::lap(int stage, double start)
+	{
+		double end = now();
+		record(stage, start, end - start);
+		return end;
+	}
+
+	void Profiler::drain()
+	{
+		ProfileSample sample;
+		for (int s = 0; s < PROFILE_STAGES; s++)
+		{
+			while (rings[s]->pop(sample))
+			{
+				recent[s].add(sample.duration);
+				overall[s].add(sample.duration);
+				if (keepHistory) history.push_back(sample);
+			}
+		}
+	}
+
+	void Profiler::report()
+	{
+		drain();
+		std::printf("Stages p50/p99 ms:");
+		for (int s = 0; s < PROFILE_STAGES; s++)
+		{
+			std::printf(" %s %.3f/%.3f", stageName(s), recent[s].percentile(0.5) * 1000.0, recent[s].percentile(0.99) * 1000.0);
+			recent[s].clear();
+		}
+		std::printf("\n");
+	}
+
+	void Profiler::summary()
+	{
+		drain();
+		std::printf("%-10s %8s %10s %10s %10s %10s\n", "stage", "samples", "mean ms", "p50 ms", "p99 ms", "max ms");
+		for (int s = 0; s < PROFILE_STAGES; s++)
+		{
+			LatencyHistogram &h = overall[s];
+			std::printf("%-10s %8i %10.3f %10.3f %10.3f %10.3f", stageName(s), h.count, h.mean() * 1000.0,
+				h.percentile(0.5) * 1000.0, h.percentile(0.99) * 1000.0, h.longest * 1000.0);
+			int dropped = rings[s]->dropped.load();
+			if (dropped > 0) std::printf("  (%i dropped)", dropped);
+			std::printf("\n");
+		}
+	}
+
+	static bool startsBefore(const ProfileSample &a, const ProfileSample &b)
+	{
+		return a.start < b.start;
+	}
+
+	bool Profiler::save(const char* filename)
+	{
+		drain();
+		// drain() goes stage by stage
+		std::stable_sort(history.begin(), history.end(), startsBefore);
+		FILE *file = std::fopen(filename, "w");
+		if (!file)
+		{
+			std::printf("Could not write profile %s\n", filename);
+			return false;
+		}
+		size_t length = std::strlen(filename);
+		bool csv = length >= 4 && std::strcmp(filename + length - 4, ".csv") == 0;
+		if (csv)
+		{
+			std::fprintf(file, "frame,stage,start_ms,duration_ms\n");
+			for (int i = 0; i < history.size(); i++)
+			{
+				ProfileSample &sample = history[i];
+				std::fprintf(file, "%lld,%s,%.4f,%.4f\n", sample.frame, stageName(sample.stage), sample.start * 1000.0, sample.duration * 1000.0);
+			}
+		}
+		else
+		{
+			// CPU stages on one track and the GPU on another. A GPU sample
+			// only has a duration, so it starts where its draw was issued.
+			std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+			std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+			std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+			for (int i = 0; i < history.size(); i++)
+			{
+				ProfileSample &sample = history[i];
+				std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%lld}}",
+					stageName(sample.stage), sample.stage == STAGE_GPU ? 2 : 1, sample.start * 1000000.0, sample.duration * 1000000.0, sample.frame);
+			}
+			std::fprintf(file, "\n]}\n");
+		}
+		bool ok = std::ferror(file) == 0;
+		std::fclose(file);
+		if (!ok) std::printf("Could not write profile %s\n", filename);
+		else std::printf("profile: %i samples written to %s\n", (int)history.size(), filename);
+		return ok;
+	}
+
+}
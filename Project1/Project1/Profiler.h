@@ -0,0 +1,95 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+#define STAGE_POLL 0
+#define STAGE_UPDATE 1
+#define STAGE_UNIFORMS 2
+#define STAGE_DRAW 3
+#define STAGE_SWAP 4
+#define STAGE_GPU 5
+#define PROFILE_STAGES 6
+
+namespace rme
+{
+
+	const char* stageName(int stage);
+
+	struct ProfileSample
+	{
+		long long frame;
+		double start; // seconds since the profiler was made
+		double duration;
+		int stage;
+	};
+
+	// Fixed size queue for exactly one producing and one consuming thread.
+	// Neither side locks or waits; a push onto a full ring is dropped and
+	// counted.
+	class SampleRing
+	{
+		std::vector<ProfileSample> slots;
+		unsigned int mask;
+		std::atomic<unsigned int> head; // next slot to write, owned by the producer
+		std::atomic<unsigned int> tail; // next slot to read, owned by the consumer
+
+	public:
+		std::atomic<int> dropped;
+		// capacity is rounded up to a power of two
+		SampleRing(int capacity);
+		bool push(const ProfileSample &sample);
+		bool pop(ProfileSample &sample);
+	};
+
+	// Durations in logarithmic buckets, 16 per doubling from 1ns, so
+	// percentiles are within about 4% without keeping every sample
+	class LatencyHistogram
+	{
+		std::vector<int> buckets;
+
+	public:
+		int count;
+		double total;
+		double longest;
+		LatencyHistogram();
+		void add(double seconds);
+		void clear();
+		double percentile(double p);
+		double mean();
+	};
+
+	// Per-stage timings of the frame loop. Each stage is recorded from one
+	// thread into its own ring, and drain(), from any single thread, moves
+	// them into histograms and, when kept, the history that save() writes.
+	class Profiler
+	{
+		std::chrono::high_resolution_clock::time_point epoch;
+		std::vector<SampleRing*> rings;
+
+	public:
+		std::atomic<long long> frame;
+		bool keepHistory;
+		std::vector<ProfileSample> history;
+		LatencyHistogram recent[PROFILE_STAGES]; // since the last report()
+		LatencyHistogram overall[PROFILE_STAGES];
+		Profiler(bool keepHistory);
+		~Profiler();
+		double now();
+		void beginFrame();
+		void record(int stage, double start, double duration);
+		// For results that arrive after their frame, like GPU timings
+		void record(int stage, long long frame, double start, double duration);
+		// Records [start, now) for stage and returns now, to chain stages
+		double lap(int stage, double start);
+		void drain();
+		// Prints p50/p99 of every stage since the last report
+		void report();
+		// Prints p50/p99 over the whole run
+		void summary();
+		// .csv writes one row per sample, anything else Chrome's trace
+		// event JSON (chrome://tracing, ui.perfetto.dev)
+		bool save(const char* filename);
+	};
+
+}
@@ -0,0 +1,798 @@
+#include "RaymarchRenderer.h"
+#include "SimClock.h"
+#include <cstring>
+
+extern rme::InputQueue *inputQueue;
+
+namespace rme
+{
+
+	// Puts the scene's staticMap() in place of the default one between
+	// march.frag's //#static markers
+	static void spliceStatic(std::string &source, const std::string &glsl)
+	{
+		const std::string open = "//#static\n", close = "//#endstatic";
+		size_t begin = source.find(open);
+		size_t end = source.find(close);
+		if (begin == std::string::npos || end == std::string::npos || end < begin)
+		{
+			std::cout << "march.frag has no //#static block, static geometry is not drawn\n";
+			return;
+		}
+		begin += open.size();
+		source.replace(begin, end - begin, glsl);
+	}
+
+	// Defines what march.frag shares with RenderStats.h straight after its
+	// #version line, so the bins are laid out in one place. #line keeps
+	// compile errors pointing at the file's own lines.
+	static void defineConstants(std::string &source)
+	{
+		std::string defines =
+			"#define STATS_OFF " + std::to_string(STATS_OFF) + "\n"
+			"#define STATS_STEPS " + std::to_string(STATS_STEPS) + "\n"
+			"#define STATS_MARCHES " + std::to_string(STATS_MARCHES) + "\n"
+			"#define STATS_OBJECTS " + std::to_string(STATS_OBJECTS) + "\n"
+			"#define STATS_BINS " + std::to_string(STATS_BINS) + "\n"
+			"#define STATS_STEP_BIN " + std::to_string(STATS_STEP_BIN) + "\n"
+			"#define STATS_MARCHES_MAX " + std::to_string(STATS_MARCHES_MAX) + "\n"
+			"#line 2\n";
+		size_t line = source.find('\n');
+		source.insert(line == std::string::npos ? 0 : line + 1, defines);
+	}
+
+	// march.frag's TileBlock: this header, then the tiles, the warp list
+	// and the object list of rme::ScreenTiles one after another
+	struct GpuTileHeader
+	{
+		int tileSize;
+		int tilesX;
+		int tilesY;
+		int warpListOffset;
+		int objectListOffset;
+		int globalCount;
+	};
+
+	// march.frag's StatsBlock
+	struct GpuStats
+	{
+		unsigned int pixels;
+		unsigned int steps[2], objects[2], marches[2]; // low and high words
+		unsigned int stepHistogram[STATS_BINS];
+		unsigned int objectHistogram[STATS_BINS];
+		unsigned int marchHistogram[STATS_MARCHES_MAX + 1];
+	};
+
+	// march.frag's WarpBlock is the count, padded to 16 bytes, then these
+	struct GpuWarp
+	{
+		float a[3];
+		int indexA;
+		float b[3];
+		int indexB;
+		float influence;
+		float padding[3];
+	};
+
+	RaymarchRenderer::RaymarchRenderer(int w, int h, const StaticSdf *staticGeometry, BrickMap *staticBake, bool visible)
+	{
+		width = w;
+		height = h;
+
+		// Init GLFW
+		glfwInit();
+		// Set all the required options for GLFW
+		// Shader storage buffers need 4.3
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+		glfwWindowHint(GLFW_VISIBLE, visible ? GL_TRUE : GL_FALSE);
+		
+		// Create a GLFWwindow object that we can use for GLFW's functions
+		window = glfwCreateWindow(width, height, "Time", nullptr, nullptr);
+		glfwMakeContextCurrent(window);
+		// Nothing is shown, so frames are not held back for the display
+		if (!visible) glfwSwapInterval(0);
+
+		// Disable mouse 
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+		// Set the required callback functions
+		glfwSetKeyCallback(window, key_callback);
+		glfwSetCursorPosCallback(window, cursor_pos_callback);
+		glfwSetMouseButtonCallback(window, mouse_button_callback);
+
+		// Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
+		glewExperimental = GL_TRUE;
+		// Initialize GLEW to setup the OpenGL Function pointers
+		glewInit();
+		
+		// get version info
+		const GLubyte* hardware = glGetString(GL_RENDERER); // get renderer string
+		const GLubyte* version = glGetString(GL_VERSION); // version as a string
+		printf("Hardware: %s\n", hardware);
+		printf("OpenGL version supported %s\n", version);
+
+		// Define the viewport dimensions
+		glfwGetFramebufferSize(window, &viewWidth, &viewHeight);
+		glViewport(0, 0, viewWidth, viewHeight);
+		renderWidth = viewWidth;
+		renderHeight = viewHeight;
+		resolution = nullptr;
+		frameCount = 0;
+		reprojection = false;
+		historyFilled = false;
+		historyCurrent = 0;
+		readback = false;
+		outputFbo = 0;
+		outputColor = 0;
+		readbackOldest = 0;
+		readbackPending = 0;
+		statsMode = STATS_OFF;
+		statsFrames = 0;
+		statsSkipped = 0;
+		for (int i = 0; i < STATS_FRAMES; i++)
+		{
+			statsBuffers[i] = 0;
+			statsFences[i] = 0;
+		}
+
+		// Load shaders. The program comes from the binary cache when the
+		// sources and driver are unchanged, otherwise it is compiled in the
+		// background and frames are cleared until it is ready.
+		// Scenes with static geometry get their own file, so switching back
+		// and forth does not recompile every time
+		drawsStatic = staticGeometry != nullptr;
+		bake = staticGeometry ? staticBake : nullptr;
+		shaders = new ShaderCache(window, bake ? "shaders/march-baked.bin" : staticGeometry ? "shaders/march-static.bin" : "shaders/march.bin");
+		buildProgram(staticGeometry);
+
+		// Set up vertex data (and buffer(s)) and attribute pointers
+		//GLfloat vertices[] = {
+		//  // First triangle
+		//   0.5f,  0.5f,  // Top Right
+		//   0.5f, -0.5f,  // Bottom Right
+		//  -0.5f,  0.5f,  // Top Left 
+		//  // Second triangle
+		//   0.5f, -0.5f,  // Bottom Right
+		//  -0.5f, -0.5f,  // Bottom Left
+		//  -0.5f,  0.5f   // Top Left
+		//}; 
+		GLfloat vertices[] = {
+			1.0f, 1.0f, 0.0f,  // Top Right
+			1.0f, -1.0f, 0.0f,  // Bottom Right
+			-1.0f, -1.0f, 0.0f,  // Bottom Left
+			-1.0f, 1.0f, 0.0f   // Top Left 
+		};
+		GLuint indices[] = {  // Note that we start from 0!
+			0, 1, 3,  // First Triangle
+			1, 2, 3   // Second Triangle
+		};
+		//GLuint VBO, VAO, EBO;
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+		// Bind the Vertex Array Object first, then bind and set vertex buffer(s) and attribute pointer(s).
+		glBindVertexArray(VAO);
+
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+		glEnableVertexAttribArray(0);
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0); // Note that this is allowed, the call to 
+		// glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
+
+		glBindVertexArray(0); // Unbind VAO (it's always a good thing to unbind any 
+		// buffer/array to prevent strange bugs), remember: do NOT unbind the EBO, keep it bound to this VAO
+
+		// Sized for the full window, rounded up to whole tiles
+		glGenTextures(1, &coneTexture);
+		glBindTexture(GL_TEXTURE_2D, coneTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, (viewWidth + CONE_TILE - 1) / CONE_TILE, (viewHeight + CONE_TILE - 1) / CONE_TILE, 0, GL_RED, GL_FLOAT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenFramebuffers(1, &coneFbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, coneFbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, coneTexture, 0);
+		conePrepass = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		if (!conePrepass) std::cout << "Depth prepass framebuffer incomplete, rays start at the camera\n";
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		profiler = nullptr;
+		// Deep enough that a result is always back before its slot comes round
+		gpuTimer = new GpuTimer(4);
+
+		objectBuffer = new ObjectBuffer(64, 0);
+		printf("Object upload: %s\n", objectBuffer->isPersistent() ? "persistent mapped storage buffer" : "glBufferSubData");
+		glGenBuffers(1, &warpBuffer);
+		glGenBuffers(1, &tileBuffer);
+
+		// Filled by uploadBake(), on units 2 and 3 for good
+		bakeLayers = 0;
+		if (bake)
+		{
+			glGenTextures(1, &bakeCells);
+			glGenTextures(1, &bakeBricks);
+			GLuint textures[2] = { bakeCells, bakeBricks };
+			for (int i = 0; i < 2; i++)
+			{
+				glActiveTexture(GL_TEXTURE2 + i);
+				glBindTexture(GL_TEXTURE_3D, textures[i]);
+				// The cells are read with texelFetch, the bricks filtered
+				GLint filter = i == 0 ? GL_NEAREST : GL_LINEAR;
+				glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+				glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+				glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+				glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+				glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+			}
+			glActiveTexture(GL_TEXTURE0);
+			uploadBake();
+		}
+
+		glfwSetTime(0.0);
+
+	}
+
+	void RaymarchRenderer::buildProgram(const StaticSdf *staticGeometry)
+	{
+		std::string frag = loadSource("shaders/march.frag");
+		defineConstants(frag);
+		if (staticGeometry) spliceStatic(frag, staticGeometry->glsl + (bake ? bake->glsl : "float staticMap(vec3 p)\n{\n\treturn staticExact(p);\n}\n"));
+		shaders->build(loadSource("shaders/pass.vert"), frag);
+		shaderProgram = 0;
+		if (shaders->poll()) setupProgram();
+	}
+
+	void RaymarchRenderer::setStaticGeometry(const StaticSdf *staticGeometry)
+	{
+		// The textures and the cache file were chosen with the geometry
+		if (!drawsStatic || !staticGeometry)
+		{
+			std::cout << "Static geometry can only be changed, not added or removed, after the renderer is built\n";
+			return;
+		}
+		buildProgram(staticGeometry);
+	}
+
+	void RaymarchRenderer::setupProgram()
+	{
+		shaderProgram = shaders->program;
+		printf("Shader program: %s in %.0f ms\n", shaders->fromCache ? "loaded from cache" : "compiled", shaders->buildTime * 1000.0);
+
+		timeLocation = glGetUniformLocation(shaderProgram, "time");
+		resolutionLocation = glGetUniformLocation(shaderProgram, "resolution");
+		rotationLocation = glGetUniformLocation(shaderProgram, "cameraRotation");
+		camPosLocation = glGetUniformLocation(shaderProgram, "cameraPos");
+
+		conePrepassLocation = glGetUniformLocation(shaderProgram, "conePrepass");
+		coneTileLocation = glGetUniformLocation(shaderProgram, "coneTile");
+		coneDepthLocation = glGetUniformLocation(shaderProgram, "coneDepth");
+
+		historyValidLocation = glGetUniformLocation(shaderProgram, "historyValid");
+		writeHistoryLocation = glGetUniformLocation(shaderProgram, "writeHistory");
+		frameIndexLocation = glGetUniformLocation(shaderProgram, "frameIndex");
+		prevCameraPosLocation = glGetUniformLocation(shaderProgram, "prevCameraPos");
+		prevCameraRotationLocation = glGetUniformLocation(shaderProgram, "prevCameraRotation");
+		prevResolutionLocation = glGetUniformLocation(shaderProgram, "prevResolution");
+		historyInLocation = glGetUniformLocation(shaderProgram, "historyIn");
+		statsModeLocation = glGetUniformLocation(shaderProgram, "statsMode");
+
+		glUseProgram(shaderProgram);
+
+		glUniform2f(resolutionLocation, (GLfloat)viewWidth, (GLfloat)viewHeight);
+
+		glUniform2f(rotationLocation, 0.0, 0.0);
+		glUniform1i(conePrepassLocation, 0);
+		glUniform1i(coneTileLocation, 0);
+		glUniform1i(coneDepthLocation, 0);
+		glUniform1i(historyInLocation, 1);
+		if (bake)
+		{
+			glUniform1i(glGetUniformLocation(shaderProgram, "staticCells"), 2);
+			glUniform1i(glGetUniformLocation(shaderProgram, "staticBricks"), 3);
+			glUniform3f(glGetUniformLocation(shaderProgram, "bakeOrigin"), bake->origin.x, bake->origin.y, bake->origin.z);
+			glUniform1f(glGetUniformLocation(shaderProgram, "bakeCellSize"), bake->cellSize);
+		}
+	}
+
+	void RaymarchRenderer::uploadBake()
+	{
+		if (bake->cellsDirty)
+		{
+			std::vector<float> cells(bake->slotOf.size() * 2);
+			for (int c = 0; c < bake->slotOf.size(); c++)
+			{
+				cells[2 * c] = float(bake->slotOf[c]);
+				cells[2 * c + 1] = bake->coarse[c];
+			}
+			glActiveTexture(GL_TEXTURE2);
+			glTexImage3D(GL_TEXTURE_3D, 0, GL_RG32F, bake->dims.x, bake->dims.y, bake->dims.z, 0, GL_RG, GL_FLOAT, cells.data());
+			bake->cellsDirty = false;
+		}
+		if (!bake->dirtySlots.empty())
+		{
+			const int edge = BRICK_SIZE + 1, perLayer = BRICK_ATLAS_ROW * BRICK_ATLAS_ROW;
+			glActiveTexture(GL_TEXTURE3);
+			int layers = (bake->slotCount() + perLayer - 1) / perLayer;
+			if (layers > bakeLayers)
+			{
+				// A new atlas starts empty, so every slot goes up again
+				glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, BRICK_ATLAS_ROW * edge, BRICK_ATLAS_ROW * edge, layers * edge, 0, GL_RED, GL_FLOAT, nullptr);
+				bakeLayers = layers;
+				bake->dirtySlots.clear();
+				for (int slot = 0; slot < bake->slotCount(); slot++) bake->dirtySlots.push_back(slot);
+			}
+			for (int i = 0; i < bake->dirtySlots.size(); i++)
+			{
+				int slot = bake->dirtySlots[i];
+				glTexSubImage3D(GL_TEXTURE_3D, 0, (slot % BRICK_ATLAS_ROW) * edge, (slot / BRICK_ATLAS_ROW % BRICK_ATLAS_ROW) * edge, slot / perLayer * edge,
+					edge, edge, edge, GL_RED, GL_FLOAT, &bake->samples[slot * BRICK_SAMPLES]);
+			}
+			bake->dirtySlots.clear();
+		}
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	void RaymarchRenderer::render(Scene* scene, Camera* camera)
+	{
+		double start = profiler ? profiler->now() : 0.0;
+
+		// Check if any events have been activiated (key pressed, mouse moved etc.) 
+		// and call corresponding response functions
+		glfwPollEvents();
+		if (profiler) start = profiler->lap(STAGE_POLL, start);
+		bool timing = profiler || resolution;
+		if (timing && gpuTimer->collect(profiler) > 0 && resolution)
+		{
+			int drawn = gpuTimer->lastFrame % FRAME_HISTORY;
+			resolution->update(gpuTimer->lastElapsed, drawnPixels[drawn], double(viewWidth) * viewHeight);
+		}
+
+		// Render
+		// Clear the colorbuffer
+		glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+
+		if (!shaderProgram)
+		{
+			if (!shaders->poll())
+			{
+				glClear(GL_COLOR_BUFFER_BIT);
+				glfwSwapBuffers(window);
+				return;
+			}
+			setupProgram();
+		}
+
+		// With a frame budget the scene is marched into part of sceneTexture
+		// and stretched over the window afterwards
+		if (resolution)
+		{
+			renderWidth = glm::max(1, int(resolution->scale * viewWidth + 0.5f));
+			renderHeight = glm::max(1, int(resolution->scale * viewHeight + 0.5f));
+			glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+			glViewport(0, 0, renderWidth, renderHeight);
+		}
+		else glBindFramebuffer(GL_FRAMEBUFFER, outputFbo);
+		glClear(GL_COLOR_BUFFER_BIT);
+			
+		// Update uniforms with Scene
+		
+		if (bake) uploadBake();
+		updateUniforms(scene, camera);
+
+		glUniform1f(timeLocation, float(glfwGetTime()));
+		if (resolution) glUniform2f(resolutionLocation, (GLfloat)renderWidth, (GLfloat)renderHeight);
+		if (profiler) start = profiler->lap(STAGE_UNIFORMS, start);
+
+		// Draw our first triangle
+		glUseProgram(shaderProgram);
+		glBindVertexArray(VAO);
+		long long frame = profiler ? profiler->frame.load() : frameCount;
+		frameCount++;
+		drawnPixels[frame % FRAME_HISTORY] = double(renderWidth) * renderHeight;
+		if (timing) gpuTimer->begin(frame, start);
+		if (conePrepass)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, coneFbo);
+			glViewport(0, 0, (renderWidth + CONE_TILE - 1) / CONE_TILE, (renderHeight + CONE_TILE - 1) / CONE_TILE);
+			glUniform1i(conePrepassLocation, 1);
+			glUniform1i(coneTileLocation, CONE_TILE);
+			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+			glUniform1i(conePrepassLocation, 0);
+			glBindFramebuffer(GL_FRAMEBUFFER, resolution ? sceneFbo : outputFbo);
+			glViewport(0, 0, renderWidth, renderHeight);
+			glBindTexture(GL_TEXTURE_2D, coneTexture);
+		}
+		else glUniform1i(coneTileLocation, 0);
+		glUniform1i(statsModeLocation, statsMode);
+		if (statsMode != STATS_OFF)
+		{
+			// Zeroed for this frame, while the GPU may still fill the others
+			GLuint buffer = statsBuffers[statsFrames % STATS_FRAMES];
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+			glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, buffer);
+		}
+		glUniform1i(writeHistoryLocation, reprojection);
+		glUniform1i(historyValidLocation, reprojection && historyFilled);
+		if (reprojection)
+		{
+			glUniform1i(frameIndexLocation, int(frame & 3));
+			glUniform3f(prevCameraPosLocation, prevCameraPos.x, prevCameraPos.y, prevCameraPos.z);
+			glUniform2f(prevCameraRotationLocation, prevCameraRotation.x, prevCameraRotation.y);
+			glUniform2f(prevResolutionLocation, (GLfloat)prevWidth, (GLfloat)prevHeight);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, historyTextures[historyCurrent]);
+			glActiveTexture(GL_TEXTURE0);
+			glBindImageTexture(0, historyTextures[1 - historyCurrent], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+		}
+	//	glDrawArrays(GL_TRIANGLES, 0, 6);
+		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+		if (conePrepass) glBindTexture(GL_TEXTURE_2D, 0);
+		if (reprojection)
+		{
+			// Next frame samples what the image stores wrote
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+			historyCurrent = 1 - historyCurrent;
+			historyFilled = true;
+			prevCameraPos = drawnCameraPos;
+			prevCameraRotation = drawnCameraRotation;
+			prevWidth = renderWidth;
+			prevHeight = renderHeight;
+		}
+		if (timing) gpuTimer->end();
+		glBindVertexArray(0);
+		if (statsMode != STATS_OFF)
+		{
+			// Read back with glGetBufferSubData once the fence is passed
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			statsFences[statsFrames % STATS_FRAMES] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			statsFrames++;
+			collectStats();
+		}
+
+		if (resolution)
+		{
+			// Bilinear upscale, which costs next to nothing beside the march
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFbo);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, outputFbo);
+			glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, viewWidth, viewHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+			glBindFramebuffer(GL_FRAMEBUFFER, outputFbo);
+			glViewport(0, 0, viewWidth, viewHeight);
+		}
+		objectBuffer->fence();
+		if (readback)
+		{
+			if (readbackPending < READBACK_FRAMES)
+			{
+				// Returns at once; the copy runs after the draw on the GPU
+				int slot = (readbackOldest + readbackPending) % READBACK_FRAMES;
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[slot]);
+				glReadPixels(0, 0, viewWidth, viewHeight, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+				readbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				readbackPending++;
+			}
+			else std::cout << "Readback ring full, frame not kept\n";
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		}
+		if (profiler) start = profiler->lap(STAGE_DRAW, start);
+		
+		// Swap the screen buffers
+		glfwSwapBuffers(window);
+		if (profiler) profiler->lap(STAGE_SWAP, start);
+
+	}
+
+	void RaymarchRenderer::setFrameBudget(double seconds)
+	{
+		if (!resolution)
+		{
+			// Full size, so any scale fits without reallocating
+			glGenTextures(1, &sceneTexture);
+			glBindTexture(GL_TEXTURE_2D, sceneTexture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, viewWidth, viewHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glGenFramebuffers(1, &sceneFbo);
+			glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sceneTexture, 0);
+			bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			if (!complete)
+			{
+				std::cout << "Offscreen framebuffer incomplete, keeping full resolution\n";
+				glDeleteFramebuffers(1, &sceneFbo);
+				glDeleteTextures(1, &sceneTexture);
+				return;
+			}
+			resolution = new ResolutionController(seconds);
+		}
+		resolution->budget = seconds;
+	}
+
+	void RaymarchRenderer::enableReprojection()
+	{
+		if (reprojection) return;
+		// Full size, like sceneTexture
+		glGenTextures(2, historyTextures);
+		for (int i = 0; i < 2; i++)
+		{
+			glBindTexture(GL_TEXTURE_2D, historyTextures[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, viewWidth, viewHeight, 0, GL_RG, GL_FLOAT, nullptr);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		reprojection = true;
+		historyFilled = false;
+	}
+
+	float RaymarchRenderer::getResolutionScale()
+	{
+		return resolution ? resolution->scale : 1.0f;
+	}
+
+	void RaymarchRenderer::updateUniforms(Scene* scene, Camera* camera)
+	{
+		glm::vec3 cameraPos = camera->slot >= 0 ? scene->renderPosition(camera->slot) : camera->position;
+		glUniform2f(rotationLocation, scene->viewRotation.x, scene->viewRotation.y);
+		glUniform3f(camPosLocation, cameraPos.x, cameraPos.y, cameraPos.z);
+		drawnCameraPos = cameraPos;
+		drawnCameraRotation = scene->viewRotation;
+
+		objectBuffer->upload(scene);
+		// Tiles follow the camera, so they are culled again every frame. Each
+		// cone tile of the prepass lies inside one of them.
+		tiles.build(scene, objectBuffer->grid, cameraPos, scene->viewRotation, renderWidth, renderHeight);
+		uploadTiles();
+	}
+
+	void RaymarchRenderer::uploadTiles()
+	{
+		const int warpsStart = 16;
+		tileData.assign(warpsStart + tiles.pairs.size() * sizeof(GpuWarp), 0);
+		int count = tiles.pairs.size();
+		std::memcpy(&tileData[0], &count, sizeof(count));
+		for (int n = 0; n < tiles.pairs.size(); n++)
+		{
+			const ScreenTiles::Pair &pair = tiles.pairs[n];
+			GpuWarp gpu;
+			std::memset(&gpu, 0, sizeof(gpu));
+			gpu.a[0] = pair.a.x;
+			gpu.a[1] = pair.a.y;
+			gpu.a[2] = pair.a.z;
+			gpu.indexA = pair.indexA;
+			gpu.b[0] = pair.b.x;
+			gpu.b[1] = pair.b.y;
+			gpu.b[2] = pair.b.z;
+			gpu.indexB = pair.indexB;
+			gpu.influence = pair.influence;
+			std::memcpy(&tileData[warpsStart + n * sizeof(GpuWarp)], &gpu, sizeof(gpu));
+		}
+		// Orphaned every frame, the driver hands out fresh storage while the
+		// last frame's draw still reads the old one
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, warpBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, tileData.size(), &tileData[0], GL_STREAM_DRAW);
+
+		GpuTileHeader header;
+		header.tileSize = tiles.tileSize;
+		header.tilesX = tiles.tilesX;
+		header.tilesY = tiles.tilesY;
+		header.warpListOffset = tiles.tiles.size();
+		header.objectListOffset = tiles.tiles.size() + tiles.warpList.size();
+		header.globalCount = tiles.globalCount;
+		int tileInts = tiles.tiles.size(), warpInts = tiles.warpList.size(), objectInts = tiles.objectList.size();
+		tileData.resize(sizeof(header) + (tileInts + warpInts + objectInts) * sizeof(int));
+		unsigned char *out = &tileData[0];
+		std::memcpy(out, &header, sizeof(header));
+		out += sizeof(header);
+		if (tileInts > 0) std::memcpy(out, &tiles.tiles[0], tileInts * sizeof(int));
+		out += tileInts * sizeof(int);
+		if (warpInts > 0) std::memcpy(out, &tiles.warpList[0], warpInts * sizeof(int));
+		out += warpInts * sizeof(int);
+		if (objectInts > 0) std::memcpy(out, &tiles.objectList[0], objectInts * sizeof(int));
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, tileData.size(), &tileData[0], GL_STREAM_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, warpBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, tileBuffer);
+	}
+
+	void RaymarchRenderer::enableStats(int mode)
+	{
+		if (!statsBuffers[0] && mode != STATS_OFF)
+		{
+			glGenBuffers(STATS_FRAMES, statsBuffers);
+			for (int i = 0; i < STATS_FRAMES; i++)
+			{
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffers[i]);
+				glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuStats), nullptr, GL_DYNAMIC_READ);
+			}
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		}
+		// Buffers are kept once made, so the mode can change freely
+		statsMode = mode;
+	}
+
+	void RaymarchRenderer::collectStats()
+	{
+		// The oldest frame still in the ring, which has normally finished.
+		// Its buffer is cleared for the next frame either way, so a frame
+		// the GPU is still drawing is dropped rather than waited for, which
+		// would hold up the frames whose cost this is measuring.
+		int slot = statsFrames % STATS_FRAMES;
+		if (!statsFences[slot]) return;
+		GLenum status = glClientWaitSync(statsFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		glDeleteSync(statsFences[slot]);
+		statsFences[slot] = 0;
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		{
+			statsSkipped++;
+			return;
+		}
+
+		GpuStats gpu;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffers[slot]);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(gpu), &gpu);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		stats.pixels = gpu.pixels;
+		stats.steps = (unsigned long long)gpu.steps[1] << 32 | gpu.steps[0];
+		stats.objects = (unsigned long long)gpu.objects[1] << 32 | gpu.objects[0];
+		stats.marches = (unsigned long long)gpu.marches[1] << 32 | gpu.marches[0];
+		std::memcpy(stats.stepHistogram, gpu.stepHistogram, sizeof(stats.stepHistogram));
+		std::memcpy(stats.objectHistogram, gpu.objectHistogram, sizeof(stats.objectHistogram));
+		std::memcpy(stats.marchHistogram, gpu.marchHistogram, sizeof(stats.marchHistogram));
+	}
+
+	void RaymarchRenderer::waitForShaders()
+	{
+		if (shaderProgram) return;
+		shaders->wait();
+		setupProgram();
+	}
+
+	void RaymarchRenderer::enableReadback()
+	{
+		if (readback) return;
+		glGenRenderbuffers(1, &outputColor);
+		glBindRenderbuffer(GL_RENDERBUFFER, outputColor);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, viewWidth, viewHeight);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glGenFramebuffers(1, &outputFbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, outputFbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, outputColor);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (!complete)
+		{
+			std::cout << "Readback framebuffer incomplete, reading the window\n";
+			glDeleteFramebuffers(1, &outputFbo);
+			glDeleteRenderbuffers(1, &outputColor);
+			outputFbo = 0;
+			outputColor = 0;
+		}
+		glGenBuffers(READBACK_FRAMES, readbackBuffers);
+		for (int i = 0; i < READBACK_FRAMES; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(viewWidth) * viewHeight * 3, nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		// Rows of RGB are packed tight
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		readback = true;
+	}
+
+	int RaymarchRenderer::pendingFrames()
+	{
+		return readbackPending;
+	}
+
+	bool RaymarchRenderer::readFrame(std::vector<unsigned char> &rgb, bool wait)
+	{
+		if (readbackPending == 0) return false;
+		GLsync fence = readbackFences[readbackOldest];
+		GLenum status = glClientWaitSync(fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) return false;
+		glDeleteSync(fence);
+
+		size_t size = size_t(viewWidth) * viewHeight * 3;
+		rgb.resize(size);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[readbackOldest]);
+		void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		if (pixels)
+		{
+			std::memcpy(&rgb[0], pixels, size);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		readbackOldest = (readbackOldest + 1) % READBACK_FRAMES;
+		readbackPending--;
+		return pixels != nullptr;
+	}
+
+	std::string RaymarchRenderer::loadSource(char* filename)
+	{
+		std::ifstream infile{ filename };
+		return{ std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>() };
+	}
+
+	RaymarchRenderer::~RaymarchRenderer()
+	{
+		// Properly de-allocate all resources once they've outlived their purpose
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		delete objectBuffer;
+		glDeleteBuffers(1, &warpBuffer);
+		glDeleteBuffers(1, &tileBuffer);
+		delete shaders;
+		delete gpuTimer;
+		glDeleteFramebuffers(1, &coneFbo);
+		glDeleteTextures(1, &coneTexture);
+		if (reprojection) glDeleteTextures(2, historyTextures);
+		if (statsBuffers[0])
+		{
+			for (int i = 0; i < STATS_FRAMES; i++) if (statsFences[i]) glDeleteSync(statsFences[i]);
+			glDeleteBuffers(STATS_FRAMES, statsBuffers);
+		}
+		if (readback)
+		{
+			for (int i = 0; i < readbackPending; i++) glDeleteSync(readbackFences[(readbackOldest + i) % READBACK_FRAMES]);
+			glDeleteBuffers(READBACK_FRAMES, readbackBuffers);
+			if (outputFbo)
+			{
+				glDeleteFramebuffers(1, &outputFbo);
+				glDeleteRenderbuffers(1, &outputColor);
+			}
+		}
+		if (bake)
+		{
+			glDeleteTextures(1, &bakeCells);
+			glDeleteTextures(1, &bakeBricks);
+		}
+		if (resolution)
+		{
+			glDeleteFramebuffers(1, &sceneFbo);
+			glDeleteTextures(1, &sceneTexture);
+			delete resolution;
+		}
+		// Terminate GLFW, clearing any resources allocated by GLFW.
+		glfwTerminate();
+	}
+
+	void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode)
+	{
+		if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+			glfwSetWindowShouldClose(window, GL_TRUE);
+		rme::InputEvent event = { INPUT_KEY, scancode, action, 0.0, 0.0 };
+		inputQueue->push(event);
+		std::printf("keypress: %i  scancode: %i  action: %i  mode: %i\n", key, scancode, action, mode);
+	}
+
+	void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+	{
+		std::cout << "button: " << button << " action : " << action << "\n";
+		rme::InputEvent event = { INPUT_BUTTON, button, action, 0.0, 0.0 };
+		inputQueue->push(event);
+	}
+
+	static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
+	{
+		//std::cout << "xpos: " << xpos << " ypos: " << ypos << "\n";
+		rme::InputEvent event = { INPUT_MOVE, 0, 0, xpos, ypos };
+		inputQueue->push(event);
+	}
+
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "rme.h"
+
+// GLEW
+//#define GLEW_STATIC
+#include <GL/glew.h>
+
+// GLFW
+#include <GLFW/glfw3.h>
+
+#include "ObjectBuffer.h"
+#include "ShaderCache.h"
+#include "GpuTimer.h"
+#include "ResolutionController.h"
+#include "BrickMap.h"
+#include "ScreenTiles.h"
+#include "RenderStats.h"
+
+// Frames whose pixel counts are kept until their GPU time comes back
+#define FRAME_HISTORY 16
+// Pixels per side of a tile in the coarse pass that finds where rays start
+#define CONE_TILE 8
+// Frames that can be on their way back from the GPU at once
+#define READBACK_FRAMES 3
+// Cost buffers used in turn, so the one read back is two frames old
+#define STATS_FRAMES 3
+
+namespace rme
+{
+
+	class RaymarchRenderer
+	{
+		std::string loadSource(char* filename);
+		/*const*/ GLuint width, height;
+		GLuint VBO, VAO, EBO;
+		GLuint shaderProgram;
+		GLuint timeLocation, resolutionLocation, rotationLocation, camPosLocation;
+		GLuint conePrepassLocation, coneTileLocation, coneDepthLocation;
+		GLuint coneFbo, coneTexture; // one R32F distance per tile
+		GLuint historyValidLocation, writeHistoryLocation, frameIndexLocation, prevCameraPosLocation, prevCameraRotationLocation, prevResolutionLocation, historyInLocation;
+		bool reprojection;
+		GLuint historyTextures[2]; // RG32F, read last frame's while writing this one's
+		int historyCurrent; // the one written last frame
+		bool historyFilled;
+		glm::vec3 drawnCameraPos, prevCameraPos;
+		glm::vec2 drawnCameraRotation, prevCameraRotation;
+		int prevWidth, prevHeight;
+		ObjectBuffer *objectBuffer;
+		ScreenTiles tiles;
+		GLuint warpBuffer, tileBuffer; // march.frag's WarpBlock and TileBlock
+		std::vector<unsigned char> tileData; // staging for either
+		ShaderCache *shaders;
+		GpuTimer *gpuTimer;
+		GLint viewWidth, viewHeight; // window framebuffer
+		ResolutionController *resolution; // null at full resolution
+		GLuint sceneFbo, sceneTexture;
+		int renderWidth, renderHeight;
+		long long frameCount;
+		double drawnPixels[FRAME_HISTORY];
+		bool drawsStatic; // built with static geometry
+		BrickMap *bake; // not owned
+		GLuint bakeCells; // RG32F, slot and coarse value per cell
+		GLuint bakeBricks; // R32F atlas of BRICK_ATLAS_ROW^2 bricks per layer
+		int bakeLayers;
+		bool readback;
+		// Where frames end up, 0 for the window until readback is enabled
+		GLuint outputFbo, outputColor;
+		GLuint readbackBuffers[READBACK_FRAMES]; // pixel pack buffers, used in turn
+		GLsync readbackFences[READBACK_FRAMES];
+		int readbackOldest, readbackPending;
+		GLuint statsModeLocation;
+		GLuint statsBuffers[STATS_FRAMES]; // march.frag's StatsBlock
+		GLsync statsFences[STATS_FRAMES];
+		long long statsFrames; // drawn with the buffers so far
+		void collectStats();
+		// Starts building march.frag with staticGeometry's glsl spliced in
+		void buildProgram(const StaticSdf *staticGeometry);
+		void setupProgram();
+		// Sends whatever changed in the bake since the last frame
+		void uploadBake();
+		void updateUniforms(Scene* scene, Camera* camera);
+		void uploadTiles();
+		
+	public:
+		// staticGeometry, if any, is compiled into the shader. With a bake of
+		// it the march reads the bake and only the shading uses the tree.
+		// A window that is not visible is only drawn into, for readback.
+		RaymarchRenderer(int w, int h, const StaticSdf *staticGeometry = nullptr, BrickMap *bake = nullptr, bool visible = true);
+		~RaymarchRenderer();
+		GLFWwindow* window;
+		Profiler *profiler; // times each stage of render() when set, not owned
+		// Marches a coarse pass first so full resolution rays skip the empty
+		// space in front of them. Warped rays bend from the camera on, so
+		// rays through tiles a warp can reach start at the camera.
+		bool conePrepass;
+		void resize(int x, int y);
+		void render(Scene* scene, Camera* camera);
+		// Lowers the resolution whenever the march would take longer than
+		// seconds of GPU time, and raises it again when there is room
+		void setFrameBudget(double seconds);
+		float getResolutionScale();
+		// Keeps each pixel's first hit and starts next frame's rays at the
+		// same surfaces, seen from the moved camera, once they are checked
+		void enableReprojection();
+		// Unless STATS_OFF, tints every pixel by what its march cost and
+		// counts it into stats, read back a couple of frames later. stats
+		// keeps the last frame read; frames the GPU had not finished by
+		// then are counted in statsSkipped instead.
+		void enableStats(int mode);
+		int statsMode;
+		RenderStats stats;
+		int statsSkipped;
+		// Takes a changed field in place of the one the renderer was built
+		// with: the shader is built again around its staticExact(), and
+		// whatever the bake rebaked for it goes up with the next frame.
+		// Frames are cleared until the new program is ready.
+		void setStaticGeometry(const StaticSdf *staticGeometry);
+		// Blocks until the shaders are built, so no frame is left blank
+		void waitForShaders();
+		// Copies every frame rendered from now on into a pixel buffer on the
+		// GPU's own time, for readFrame() to collect frames later. Only up to
+		// READBACK_FRAMES can wait there, so they must be read as they come.
+		// Frames are drawn into a renderbuffer from then on, not the window,
+		// whose pixels are undefined wherever it is hidden or covered.
+		void enableReadback();
+		int pendingFrames();
+		// The oldest frame not yet read, as RGB rows from the bottom up.
+		// Unless wait is set, only once the GPU has finished copying it.
+		// False if there is no such frame.
+		bool readFrame(std::vector<unsigned char> &rgb, bool wait);
+	};
+
+	void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
+
+	void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
+
+	static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos);
+
+}
@@ -0,0 +1,113 @@
+#include "RenderStats.h"
+#include <cstdio>
+#include <cstring>
+
+namespace rme
+{
+
+	RenderStats::RenderStats()
+	{
+		clear();
+	}
+
+	void RenderStats::clear()
+	{
+		pixels = 0;
+		steps = 0;
+		objects = 0;
+		marches = 0;
+		std::memset(stepHistogram, 0, sizeof(stepHistogram));
+		std::memset(objectHistogram, 0, sizeof(objectHistogram));
+		std::memset(marchHistogram, 0, sizeof(marchHistogram));
+	}
+
+	int stepBin(int steps)
+	{
+		int bin = steps / STATS_STEP_BIN;
+		return bin < STATS_BINS ? bin : STATS_BINS - 1;
+	}
+
+	int objectBin(int objects)
+	{
+		int bin = 0;
+		for (unsigned int n = (unsigned int)objects + 1; n > 1; n >>= 1) bin++;
+		return bin < STATS_BINS ? bin : STATS_BINS - 1;
+	}
+
+	void RenderStats::addPixel(int pixelSteps, int pixelObjects, int pixelMarches)
+	{
+		pixels++;
+		steps += pixelSteps;
+		objects += pixelObjects;
+		marches += pixelMarches;
+		stepHistogram[stepBin(pixelSteps)]++;
+		objectHistogram[objectBin(pixelObjects)]++;
+		marchHistogram[pixelMarches < STATS_MARCHES_MAX ? pixelMarches : STATS_MARCHES_MAX]++;
+	}
+
+	void RenderStats::add(const RenderStats &other)
+	{
+		pixels += other.pixels;
+		steps += other.steps;
+		objects += other.objects;
+		marches += other.marches;
+		for (int k = 0; k < STATS_BINS; k++)
+		{
+			stepHistogram[k] += other.stepHistogram[k];
+			objectHistogram[k] += other.objectHistogram[k];
+		}
+		for (int k = 0; k <= STATS_MARCHES_MAX; k++) marchHistogram[k] += other.marchHistogram[k];
+	}
+
+	// First bin by which fraction of the pixels are counted
+	static int percentileBin(const unsigned int *histogram, unsigned int pixels, double fraction)
+	{
+		double target = fraction * pixels;
+		double sum = 0.0;
+		for (int k = 0; k < STATS_BINS; k++)
+		{
+			sum += histogram[k];
+			if (sum >= target) return k;
+		}
+		return STATS_BINS - 1;
+	}
+
+	void RenderStats::report()
+	{
+		if (pixels == 0)
+		{
+			std::printf("Cost: no pixels\n");
+			return;
+		}
+		// Upper ends of the bins the percentiles fall in
+		int steps50 = (percentileBin(stepHistogram, pixels, 0.5) + 1) * STATS_STEP_BIN;
+		int steps99 = (percentileBin(stepHistogram, pixels, 0.99) + 1) * STATS_STEP_BIN;
+		// In 64 bits, as the last bin ends at 2^32 - 1
+		unsigned long long objects50 = (2ull << percentileBin(objectHistogram, pixels, 0.5)) - 1;
+		unsigned long long objects99 = (2ull << percentileBin(objectHistogram, pixels, 0.99)) - 1;
+		unsigned int warped = pixels - marchHistogram[0] - marchHistogram[1];
+		std::printf("Cost: %u px, steps %.1f/px (p50 <%i, p99 <%i), objects %.1f/px (p50 <%llu, p99 <%llu), %.1f%% re-marched\n",
+			pixels, double(steps) / pixels, steps50, steps99, double(objects) / pixels, objects50, objects99, 100.0 * warped / pixels);
+	}
+
+	const char* statsModeName(int mode)
+	{
+		switch (mode)
+		{
+		case STATS_STEPS: return "steps";
+		case STATS_MARCHES: return "marches";
+		case STATS_OBJECTS: return "objects";
+		default: return "off";
+		}
+	}
+
+	int statsModeFromName(const char* name)
+	{
+		for (int mode = STATS_OFF; mode <= STATS_OBJECTS; mode++)
+		{
+			if (std::strcmp(name, statsModeName(mode)) == 0) return mode;
+		}
+		return -1;
+	}
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// What the stats overlay colours each pixel by
+#define STATS_OFF 0
+#define STATS_STEPS 1 // march steps, red at the 96 of one whole march
+#define STATS_MARCHES 2 // marches through warps after the first
+#define STATS_OBJECTS 3 // objects tested, on a log scale
+// Histogram bins, and march steps per bin of the step histogram: a pixel
+// marches at most three times 96 steps
+#define STATS_BINS 32
+#define STATS_STEP_BIN 9
+// Marches a pixel can take: the first and two through warps
+#define STATS_MARCHES_MAX 3
+
+namespace rme
+{
+
+	// Where one frame's march went, pixel by pixel, from march.frag or
+	// CpuRenderer. The object histogram has power of two bins, bin k
+	// counting pixels that tested at least 2^k - 1 and fewer than
+	// 2^(k+1) - 1 objects.
+	struct RenderStats
+	{
+		unsigned int pixels;
+		unsigned long long steps, objects, marches;
+		unsigned int stepHistogram[STATS_BINS];
+		unsigned int objectHistogram[STATS_BINS];
+		unsigned int marchHistogram[STATS_MARCHES_MAX + 1];
+		RenderStats();
+		void clear();
+		void addPixel(int steps, int objects, int marches);
+		void add(const RenderStats &other);
+		// One line of totals and percentiles
+		void report();
+	};
+
+	int stepBin(int steps);
+	int objectBin(int objects);
+	const char* statsModeName(int mode);
+	// -1 for a name that is not a mode
+	int statsModeFromName(const char* name);
+
+}
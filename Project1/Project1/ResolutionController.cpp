@@ -0,0 +1,32 @@
+#include "ResolutionController.h"
+#include <cmath>
+
+namespace rme
+{
+
+	ResolutionController::ResolutionController(double b)
+	{
+		budget = b;
+		minScale = 0.25f;
+		maxScale = 1.0f;
+		scale = 1.0f;
+		costPerPixel = 0.0;
+	}
+
+	void ResolutionController::update(double gpuTime, double pixels, double fullPixels)
+	{
+		if (pixels <= 0.0 || gpuTime <= 0.0) return;
+		double cost = gpuTime / pixels;
+		// Follows a change of view within a few frames, but one slow frame
+		// does not halve the resolution
+		costPerPixel = costPerPixel == 0.0 ? cost : 0.7 * costPerPixel + 0.3 * cost;
+
+		// 10% headroom for frames costlier than the average
+		double affordable = 0.9 * budget / costPerPixel;
+		float wanted = (float)std::sqrt(affordable / fullPixels);
+		if (wanted < minScale) wanted = minScale;
+		if (wanted > maxScale) wanted = maxScale;
+		if (std::fabs(wanted - scale) > 0.05f * scale || wanted == maxScale || wanted == minScale) scale = wanted;
+	}
+
+}
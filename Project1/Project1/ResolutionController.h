@@ -0,0 +1,25 @@
+#pragma once
+
+namespace rme
+{
+
+	// Picks the fraction of the window to march so the draw fits a GPU time
+	// budget. March cost is close to proportional to the pixel count, so the
+	// controller keeps a smoothed cost per pixel and sizes the next frames
+	// to spend the budget, less some headroom. Small corrections are
+	// ignored so the image does not shimmer between sizes.
+	class ResolutionController
+	{
+		double costPerPixel; // seconds, 0 until the first measurement
+
+	public:
+		double budget;   // seconds of GPU time per frame
+		float minScale;  // per axis
+		float maxScale;
+		float scale;     // per axis, what to render the next frame at
+		ResolutionController(double budget);
+		// gpuTime is what a frame of pixels took
+		void update(double gpuTime, double pixels, double fullPixels);
+	};
+
+}
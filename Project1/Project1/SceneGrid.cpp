@@ -0,0 +1,150 @@
+#include "SceneGrid.h"
+#include "rme.h"
+#include <cmath>
+
+namespace rme
+{
+
+	SceneGrid::SceneGrid()
+	{
+		origin = glm::vec3(0.0);
+		cellSize = 1.0;
+		margin = 0.5;
+		dims = glm::ivec3(0, 0, 0);
+		minGridObjects = 32;
+	}
+
+	int SceneGrid::cellCount()
+	{
+		return dims.x * dims.y * dims.z;
+	}
+
+	void SceneGrid::build(Scene *scene)
+	{
+		ObjectStore &objects = scene->objects;
+		int count = objects.size();
+		global.clear();
+		cellObjects.clear();
+
+		glm::vec3 lo = glm::vec3(1e30f), hi = glm::vec3(-1e30f);
+		int bounded = 0;
+		for (int i = 0; i < count; i++)
+		{
+			switch (objects.geometry[i]) {
+			case SPHERE:
+			{
+				glm::vec3 p = scene->renderPosition(i);
+				lo = glm::min(lo, p - glm::vec3(objects.radius[i]));
+				hi = glm::max(hi, p + glm::vec3(objects.radius[i]));
+				bounded++;
+				break;
+			}
+			case BOX_INTERIOR:
+				global.push_back(i);
+				break;
+			default:
+				// Not part of map()
+				break;
+			}
+		}
+		if (bounded < minGridObjects)
+		{
+			global.clear();
+			for (int i = 0; i < count; i++)
+			{
+				if (objects.geometry[i] == SPHERE || objects.geometry[i] == BOX_INTERIOR) global.push_back(i);
+			}
+			dims = glm::ivec3(0, 0, 0);
+			cells.clear();
+			return;
+		}
+
+		// About one object per cell, at most 64 cells along an axis
+		glm::vec3 extent = glm::max(hi - lo, glm::vec3(0.01f));
+		float longest = glm::max(extent.x, glm::max(extent.y, extent.z));
+		cellSize = std::cbrt(extent.x * extent.y * extent.z / bounded);
+		cellSize = glm::max(cellSize, longest / 64.0f);
+		margin = 0.5f * cellSize;
+		origin = lo - glm::vec3(margin);
+		glm::vec3 span = (extent + glm::vec3(2.0f * margin)) / cellSize;
+		dims = glm::ivec3((int)glm::ceil(span.x), (int)glm::ceil(span.y), (int)glm::ceil(span.z));
+		dims = glm::max(dims, glm::ivec3(1, 1, 1));
+		int total = cellCount();
+
+		// Counting sort of objects into the cells they touch
+		counts.assign(total, 0);
+		for (int pass = 0; pass < 2; pass++)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				if (objects.geometry[i] != SPHERE) continue;
+				glm::vec3 p = scene->renderPosition(i);
+				glm::vec3 reach = glm::vec3(objects.radius[i] + margin);
+				glm::ivec3 cLo = glm::clamp(glm::ivec3(glm::floor((p - reach - origin) / cellSize)), glm::ivec3(0, 0, 0), dims - glm::ivec3(1, 1, 1));
+				glm::ivec3 cHi = glm::clamp(glm::ivec3(glm::floor((p + reach - origin) / cellSize)), glm::ivec3(0, 0, 0), dims - glm::ivec3(1, 1, 1));
+				for (int z = cLo.z; z <= cHi.z; z++)
+				for (int y = cLo.y; y <= cHi.y; y++)
+				for (int x = cLo.x; x <= cHi.x; x++)
+				{
+					int cell = x + dims.x * (y + dims.y * z);
+					if (pass == 0) counts[cell]++;
+					else cellObjects[cells[2 * cell] + cells[2 * cell + 1]++] = i;
+				}
+			}
+			if (pass == 0)
+			{
+				cells.resize(2 * total);
+				int offset = 0;
+				for (int c = 0; c < total; c++)
+				{
+					cells[2 * c] = offset;
+					cells[2 * c + 1] = 0;
+					offset += counts[c];
+				}
+				cellObjects.resize(offset);
+			}
+		}
+
+		distanceTransform();
+	}
+
+	void SceneGrid::distanceTransform()
+	{
+		// Chessboard distance by a forward and a backward sweep over the
+		// 26-neighbourhood, written over the first entry of empty cells
+		const int far = 1 << 20;
+		int total = cellCount();
+		for (int c = 0; c < total; c++) counts[c] = cells[2 * c + 1] > 0 ? 0 : far;
+		for (int sweep = 0; sweep < 2; sweep++)
+		{
+			int step = sweep == 0 ? 1 : -1;
+			int x0 = sweep == 0 ? 0 : dims.x - 1;
+			int y0 = sweep == 0 ? 0 : dims.y - 1;
+			int z0 = sweep == 0 ? 0 : dims.z - 1;
+			for (int z = z0; z >= 0 && z < dims.z; z += step)
+			for (int y = y0; y >= 0 && y < dims.y; y += step)
+			for (int x = x0; x >= 0 && x < dims.x; x += step)
+			{
+				int cell = x + dims.x * (y + dims.y * z);
+				int best = counts[cell];
+				if (best == 0) continue;
+				// Neighbours already visited in this sweep's order
+				for (int dz = -1; dz <= 0; dz++)
+				for (int dy = -1; dy <= 1; dy++)
+				for (int dx = -1; dx <= 1; dx++)
+				{
+					if (dz == 0 && (dy > 0 || (dy == 0 && dx >= 0))) continue;
+					int nx = x + dx * step, ny = y + dy * step, nz = z + dz * step;
+					if (nx < 0 || ny < 0 || nz < 0 || nx >= dims.x || ny >= dims.y || nz >= dims.z) continue;
+					best = glm::min(best, counts[nx + dims.x * (ny + dims.y * nz)] + 1);
+				}
+				counts[cell] = best;
+			}
+		}
+		for (int c = 0; c < total; c++)
+		{
+			if (cells[2 * c + 1] == 0) cells[2 * c] = counts[c];
+		}
+	}
+
+}
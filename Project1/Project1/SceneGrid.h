@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include <glm.hpp>
+
+namespace rme
+{
+
+	class Scene;
+
+	// Uniform grid over the bounded objects (spheres) of a scene, shared by
+	// march.frag and CpuRenderer so map() only looks at objects near the
+	// point. Each object is listed in every cell its bounds, grown by margin,
+	// touch. An object missing from p's cell is therefore at least the
+	// distance to the cell's edge plus margin away, which map() returns as
+	// an upper bound on the step. Unbounded objects (rooms) are tested at
+	// every point, and so is everything while there are too few spheres for
+	// the shorter steps near cell edges to pay off.
+	class SceneGrid
+	{
+		std::vector<int> counts;
+		void distanceTransform();
+
+	public:
+		glm::vec3 origin;
+		float cellSize;
+		float margin;
+		glm::ivec3 dims; // all zero when the grid is not in use
+		// Two ints per cell: the first entry in cellObjects and the count.
+		// Empty cells store the Chebyshev distance, in cells, to the nearest
+		// cell that is not empty in place of the first entry.
+		std::vector<int> cells;
+		std::vector<int> cellObjects;
+		std::vector<int> global; // tested at every point, in index order, culled per screen tile by ScreenTiles
+		int minGridObjects;
+		SceneGrid();
+		// Uses the positions the scene is drawn at, see Scene::renderPosition
+		void build(Scene *scene);
+		int cellCount();
+	};
+
+}
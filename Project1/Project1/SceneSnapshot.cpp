@@ -0,0 +1,288 @@
+#include "rme.h"
+#include "MappedFile.h"
+#include <cstdio>
+#include <cstring>
+
+extern Controls *control;
+
+namespace rme
+{
+
+	static const char snapshotMagic[8] = { 'R', 'M', 'E', 'S', 'N', 'A', 'P', '2' };
+
+	// Sections start on this boundary, so a mapped file can be read in place
+	// by SIMD loads
+	#define SNAPSHOT_ALIGN 16
+
+	// Each ObjectStore field is one section of count elements, stored just
+	// as it is in memory
+	enum SnapshotSection
+	{
+		SECTION_POSITION,
+		SECTION_VELOCITY,
+		SECTION_CORRECTION,
+		SECTION_DIRECTION,
+		SECTION_SHAPE,
+		SECTION_COLOR,
+		SECTION_RADIUS,
+		SECTION_MASS,
+		SECTION_CHARGE,
+		SECTION_AGE,
+		SECTION_GEOMETRY,
+		SECTION_COLLISIONS,
+		SECTION_PHYSICS,
+		SECTION_ID,
+		SECTION_GENERATION, // idCount
+		SECTION_FREE_ID, // freeCount
+		SECTION_PREVIOUS, // previousCount positions before the last step
+		SECTION_NAME_OFFSET, // count + 1, into the name characters
+		SECTION_NAME_CHARS,
+		SECTION_WARP, // WarpPairs, by handle
+		SNAPSHOT_SECTIONS
+	};
+
+	// Every member is 4 or 8 bytes and the 8 byte ones come first, so the
+	// layout has no padding on any compiler
+	struct SnapshotHeader
+	{
+		char magic[8];
+		long long tick;
+		unsigned long long offset[SNAPSHOT_SECTIONS];
+		unsigned long long bytes[SNAPSHOT_SECTIONS];
+		int count;
+		int idCount;
+		int freeCount;
+		int previousCount;
+		int groupStart[GEOMETRY_TYPES + 1];
+		float xRotation, yRotation;
+		ObjectHandle unpairedLaunch;
+	};
+	static_assert(sizeof(SnapshotHeader) == 16 + 16 * SNAPSHOT_SECTIONS + 4 * (GEOMETRY_TYPES + 9), "snapshot header is padded");
+	static_assert(sizeof(WarpPair) == 20, "WarpPair is padded");
+
+	// Sets offset[] for the sizes in bytes[], sections following the header in order
+	static void layoutSections(SnapshotHeader &header)
+	{
+		unsigned long long end = sizeof(SnapshotHeader);
+		for (int s = 0; s < SNAPSHOT_SECTIONS; s++)
+		{
+			end = (end + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+			header.offset[s] = end;
+			end += header.bytes[s];
+		}
+	}
+
+	template <typename T>
+	static const T* section(const MappedFile &file, const SnapshotHeader &header, int s)
+	{
+		return (const T*)(file.data() + header.offset[s]);
+	}
+
+	template <typename T>
+	static void copySection(std::vector<T> &field, const MappedFile &file, const SnapshotHeader &header, int s)
+	{
+		const T* first = section<T>(file, header, s);
+		field.assign(first, first + header.bytes[s] / sizeof(T));
+	}
+
+	bool Scene::saveSnapshot(const char* filename, long long tick)
+	{
+		int count = objects.size();
+		const std::vector<unsigned int> &generations = objects.generations();
+		const std::vector<int> &freeIds = objects.freeHandles();
+		bool keepPrevious = previousPosition.size() == count;
+
+		std::vector<unsigned int> nameOffset(count + 1);
+		nameOffset[0] = 0;
+		for (int i = 0; i < count; i++) nameOffset[i + 1] = nameOffset[i] + objects.name[i].size();
+		std::vector<char> nameChars(nameOffset[count]);
+		for (int i = 0; i < count; i++)
+		{
+			if (!objects.name[i].empty()) std::memcpy(&nameChars[nameOffset[i]], objects.name[i].data(), objects.name[i].size());
+		}
+
+		SnapshotHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+		header.tick = tick;
+		header.count = count;
+		header.idCount = generations.size();
+		header.freeCount = freeIds.size();
+		header.previousCount = keepPrevious ? count : 0;
+		for (int g = 0; g < GEOMETRY_TYPES; g++) header.groupStart[g] = objects.groupBegin(g);
+		header.groupStart[GEOMETRY_TYPES] = count;
+		header.xRotation = control->xRotation;
+		header.yRotation = control->yRotation;
+		header.unpairedLaunch = unpairedLaunch;
+
+		const void* data[SNAPSHOT_SECTIONS] = {
+			objects.position.data(), objects.velocity.data(), objects.correction.data(), objects.direction.data(),
+			objects.shape.data(), objects.color.data(), objects.radius.data(), objects.mass.data(),
+			objects.charge.data(), objects.age.data(), objects.geometry.data(), objects.collisions.data(),
+			objects.physics.data(), objects.id.data(), generations.data(), freeIds.data(),
+			previousPosition.data(), nameOffset.data(), nameChars.data(), warps.data()
+		};
+		for (int s = SECTION_POSITION; s <= SECTION_COLOR; s++) header.bytes[s] = count * sizeof(glm::vec3);
+		for (int s = SECTION_RADIUS; s <= SECTION_AGE; s++) header.bytes[s] = count * sizeof(float);
+		header.bytes[SECTION_GEOMETRY] = count * sizeof(int);
+		header.bytes[SECTION_COLLISIONS] = count;
+		header.bytes[SECTION_PHYSICS] = count;
+		header.bytes[SECTION_ID] = count * sizeof(int);
+		header.bytes[SECTION_GENERATION] = header.idCount * sizeof(unsigned int);
+		header.bytes[SECTION_FREE_ID] = header.freeCount * sizeof(int);
+		header.bytes[SECTION_PREVIOUS] = header.previousCount * sizeof(glm::vec3);
+		header.bytes[SECTION_NAME_OFFSET] = (count + 1) * sizeof(unsigned int);
+		header.bytes[SECTION_NAME_CHARS] = nameChars.size();
+		header.bytes[SECTION_WARP] = warps.size() * sizeof(WarpPair);
+		layoutSections(header);
+
+		// Written beside the final name and renamed over it, so a checkpoint
+		// cut short leaves the last good one in place
+		std::string temporary = std::string(filename) + ".tmp";
+		FILE *file = std::fopen(temporary.c_str(), "wb");
+		if (!file)
+		{
+			std::printf("Could not write snapshot %s\n", temporary.c_str());
+			return false;
+		}
+		static const char padding[SNAPSHOT_ALIGN] = { 0 };
+		unsigned long long written = sizeof(header);
+		bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+		for (int s = 0; ok && s < SNAPSHOT_SECTIONS; s++)
+		{
+			ok = std::fwrite(padding, 1, header.offset[s] - written, file) == header.offset[s] - written &&
+				(header.bytes[s] == 0 || std::fwrite(data[s], 1, header.bytes[s], file) == header.bytes[s]);
+			written = header.offset[s] + header.bytes[s];
+		}
+		ok = std::fclose(file) == 0 && ok;
+		std::remove(filename);
+		if (!ok || std::rename(temporary.c_str(), filename) != 0)
+		{
+			std::printf("Could not write snapshot %s\n", filename);
+			std::remove(temporary.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// Checks everything restore() relies on before any of the scene is touched
+	static bool validSnapshot(const MappedFile &file, const SnapshotHeader &header)
+	{
+		int count = header.count;
+		if (std::memcmp(header.magic, snapshotMagic, sizeof(snapshotMagic)) != 0 || count < 0 ||
+			header.idCount < count || header.freeCount != header.idCount - count ||
+			(header.previousCount != 0 && header.previousCount != count))
+		{
+			return false;
+		}
+
+		unsigned long long expected[SNAPSHOT_SECTIONS];
+		for (int s = SECTION_POSITION; s <= SECTION_COLOR; s++) expected[s] = count * sizeof(glm::vec3);
+		for (int s = SECTION_RADIUS; s <= SECTION_AGE; s++) expected[s] = count * sizeof(float);
+		expected[SECTION_GEOMETRY] = count * sizeof(int);
+		expected[SECTION_COLLISIONS] = count;
+		expected[SECTION_PHYSICS] = count;
+		expected[SECTION_ID] = count * sizeof(int);
+		expected[SECTION_GENERATION] = header.idCount * sizeof(unsigned int);
+		expected[SECTION_FREE_ID] = header.freeCount * sizeof(int);
+		expected[SECTION_PREVIOUS] = header.previousCount * sizeof(glm::vec3);
+		expected[SECTION_NAME_OFFSET] = (count + 1) * sizeof(unsigned int);
+		expected[SECTION_NAME_CHARS] = header.bytes[SECTION_NAME_CHARS];
+		// Pairs naming objects that are gone are dropped once loaded
+		expected[SECTION_WARP] = header.bytes[SECTION_WARP] / sizeof(WarpPair) * sizeof(WarpPair);
+		size_t length = file.size();
+		for (int s = 0; s < SNAPSHOT_SECTIONS; s++)
+		{
+			if (header.bytes[s] != expected[s] || header.offset[s] % SNAPSHOT_ALIGN != 0 ||
+				header.offset[s] < sizeof(SnapshotHeader) || header.offset[s] > length || header.bytes[s] > length - header.offset[s])
+			{
+				return false;
+			}
+		}
+
+		if (header.groupStart[0] != 0 || header.groupStart[GEOMETRY_TYPES] != count) return false;
+		const int* geometry = section<int>(file, header, SECTION_GEOMETRY);
+		for (int g = 0; g < GEOMETRY_TYPES; g++)
+		{
+			if (header.groupStart[g] > header.groupStart[g + 1]) return false;
+			for (int i = header.groupStart[g]; i < header.groupStart[g + 1]; i++)
+			{
+				if (geometry[i] != g) return false;
+			}
+		}
+
+		// Every handle id is either held by exactly one object or free
+		std::vector<unsigned char> used(header.idCount, 0);
+		const int* id = section<int>(file, header, SECTION_ID);
+		const int* freeIds = section<int>(file, header, SECTION_FREE_ID);
+		for (int i = 0; i < count + header.freeCount; i++)
+		{
+			int k = i < count ? id[i] : freeIds[i - count];
+			if (k < 0 || k >= header.idCount || used[k]) return false;
+			used[k] = 1;
+		}
+
+		const unsigned int* nameOffset = section<unsigned int>(file, header, SECTION_NAME_OFFSET);
+		if (nameOffset[0] != 0 || nameOffset[count] != header.bytes[SECTION_NAME_CHARS]) return false;
+		for (int i = 0; i < count; i++)
+		{
+			if (nameOffset[i] > nameOffset[i + 1]) return false;
+		}
+		return true;
+	}
+
+	bool Scene::loadSnapshot(const char* filename, long long &tick)
+	{
+		MappedFile file;
+		if (!file.open(filename)) return false;
+		SnapshotHeader header;
+		bool valid = file.size() >= sizeof(header);
+		if (valid)
+		{
+			std::memcpy(&header, file.data(), sizeof(header));
+			valid = validSnapshot(file, header);
+		}
+		if (!valid)
+		{
+			std::printf("Snapshot %s is not valid\n", filename);
+			return false;
+		}
+
+		// Each field is one bulk copy out of the mapping
+		int count = header.count;
+		copySection(objects.position, file, header, SECTION_POSITION);
+		copySection(objects.velocity, file, header, SECTION_VELOCITY);
+		copySection(objects.correction, file, header, SECTION_CORRECTION);
+		copySection(objects.direction, file, header, SECTION_DIRECTION);
+		copySection(objects.shape, file, header, SECTION_SHAPE);
+		copySection(objects.color, file, header, SECTION_COLOR);
+		copySection(objects.radius, file, header, SECTION_RADIUS);
+		copySection(objects.mass, file, header, SECTION_MASS);
+		copySection(objects.charge, file, header, SECTION_CHARGE);
+		copySection(objects.age, file, header, SECTION_AGE);
+		copySection(objects.geometry, file, header, SECTION_GEOMETRY);
+		copySection(objects.collisions, file, header, SECTION_COLLISIONS);
+		copySection(objects.physics, file, header, SECTION_PHYSICS);
+		copySection(objects.id, file, header, SECTION_ID);
+		copySection(previousPosition, file, header, SECTION_PREVIOUS);
+		const unsigned int* nameOffset = section<unsigned int>(file, header, SECTION_NAME_OFFSET);
+		const char* nameChars = section<char>(file, header, SECTION_NAME_CHARS);
+		objects.name.resize(count);
+		for (int i = 0; i < count; i++) objects.name[i].assign(nameChars + nameOffset[i], nameOffset[i + 1] - nameOffset[i]);
+		objects.restore(header.groupStart, section<unsigned int>(file, header, SECTION_GENERATION), header.idCount,
+			section<int>(file, header, SECTION_FREE_ID), header.freeCount);
+		copySection(warps, file, header, SECTION_WARP);
+		unpairedLaunch = header.unpairedLaunch;
+		refreshWarps();
+
+		// Every index may hold a different object now; update() registers
+		// them all again
+		broadPhase->clear();
+		control->xRotation = header.xRotation;
+		control->yRotation = header.yRotation;
+		viewRotation = glm::vec2(header.xRotation, header.yRotation);
+		tick = header.tick;
+		return true;
+	}
+
+}
@@ -0,0 +1,127 @@
+#include "ScreenTiles.h"
+#include "rme.h"
+#include <cmath>
+
+namespace rme
+{
+
+	static glm::vec2 rot2D(glm::vec2 p, float angle)
+	{
+		float s = glm::sin(angle);
+		float c = glm::cos(angle);
+		return p * glm::mat2(c, s, -s, c);
+	}
+
+	// march.frag's rayDirection()
+	static glm::vec3 rayDirection(glm::vec2 pixel, int width, int height, glm::vec2 rotation)
+	{
+		glm::vec2 uv = glm::vec2(pixel.x / width, pixel.y / height) * 2.0f - 1.0f;
+		uv.x *= float(width) / float(height);
+		glm::vec3 direction = glm::normalize(glm::vec3(uv.x, uv.y, 1.2f));
+		glm::vec2 yz = rot2D(glm::vec2(direction.y, direction.z), rotation.y);
+		direction.y = yz.x;
+		direction.z = yz.y;
+		glm::vec2 xz = rot2D(glm::vec2(direction.x, direction.z), rotation.x);
+		direction.x = xz.x;
+		direction.z = xz.y;
+		return direction;
+	}
+
+	// A cone from the camera, holding every ray through one tile
+	struct TileCone
+	{
+		glm::vec3 apex, axis;
+		float s, c; // sine and cosine of the half angle
+
+		// Whether a ball of radius reaches inside
+		bool reaches(glm::vec3 centre, float radius) const
+		{
+			// Distance from the centre to the cone, in the plane through the
+			// axis and the centre
+			glm::vec3 v = centre - apex;
+			float along = glm::dot(v, axis);
+			float across = glm::length(v - along * axis);
+			float d = along * c + across * s >= 0.0f ? across * c - along * s : glm::length(v);
+			return d < radius;
+		}
+	};
+
+	ScreenTiles::ScreenTiles()
+	{
+		tileSize = 16;
+		tilesX = 0;
+		tilesY = 0;
+		globalCount = 0;
+	}
+
+	void ScreenTiles::build(Scene *scene, const SceneGrid &grid, glm::vec3 cameraPos, glm::vec2 rotation, int width, int height)
+	{
+		ObjectStore &objects = scene->objects;
+		pairs.resize(scene->warpLinks.size());
+		for (int n = 0; n < pairs.size(); n++)
+		{
+			const WarpLink &link = scene->warpLinks[n];
+			Pair &pair = pairs[n];
+			pair.a = scene->renderPosition(link.a);
+			pair.indexA = link.a;
+			pair.b = scene->renderPosition(link.b);
+			pair.indexB = link.b;
+			pair.influence = link.influence;
+		}
+		// A ray counts as a hit within 0.005 of a surface, so spheres are
+		// culled a little larger than they are
+		globalCount = grid.global.size();
+		bounds.resize(globalCount);
+		for (int n = 0; n < globalCount; n++)
+		{
+			int i = grid.global[n];
+			bounds[n] = objects.geometry[i] == SPHERE ? glm::vec4(scene->renderPosition(i), objects.radius[i] + 0.01f) : glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+		}
+
+		warpList.clear();
+		objectList.assign(grid.global.begin(), grid.global.end());
+		tilesX = (width + tileSize - 1) / tileSize;
+		tilesY = (height + tileSize - 1) / tileSize;
+		tiles.resize(4 * tilesX * tilesY);
+		for (int ty = 0; ty < tilesY; ty++)
+		{
+			for (int tx = 0; tx < tilesX; tx++)
+			{
+				int x0 = tx * tileSize, y0 = ty * tileSize;
+				int x1 = glm::min(x0 + tileSize, width), y1 = glm::min(y0 + tileSize, height);
+				TileCone cone;
+				cone.apex = cameraPos;
+				cone.axis = rayDirection(glm::vec2(0.5f * (x0 + x1), 0.5f * (y0 + y1)), width, height, rotation);
+				// Pixels are 2 / height apart on the image plane, which is 1.2
+				// from the eye, so no ray through the tile is further from
+				// the axis than half its diagonal over that
+				float halfDiagonal = 0.5f * std::sqrt(float((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0)));
+				float halfAngle = glm::min(halfDiagonal * 2.0f / height / 1.2f, 1.5f);
+				cone.s = std::sin(halfAngle);
+				cone.c = std::cos(halfAngle);
+
+				int *tile = &tiles[4 * (tx + tilesX * ty)];
+				tile[0] = warpList.size();
+				for (int n = 0; n < pairs.size(); n++)
+				{
+					if (cone.reaches(pairs[n].a, pairs[n].influence) || cone.reaches(pairs[n].b, pairs[n].influence)) warpList.push_back(n);
+				}
+				tile[1] = warpList.size() - tile[0];
+				tile[2] = objectList.size();
+				for (int n = 0; n < globalCount; n++)
+				{
+					if (bounds[n].w < 0.0f || cone.reaches(glm::vec3(bounds[n]), bounds[n].w)) objectList.push_back(grid.global[n]);
+				}
+				tile[3] = objectList.size() - tile[2];
+			}
+		}
+	}
+
+	int ScreenTiles::tileAt(float x, float y) const
+	{
+		int tx = glm::min(int(x) / tileSize, tilesX - 1);
+		int ty = glm::min(int(y) / tileSize, tilesY - 1);
+		return 4 * (tx + tilesX * ty);
+	}
+
+}
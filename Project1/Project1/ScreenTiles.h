@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include <glm.hpp>
+#include "SceneGrid.h"
+
+namespace rme
+{
+
+	class Scene;
+
+	// Per screen tile, the linked warps and the objects that can reach any
+	// ray through it, shared by march.frag and CpuRenderer. A ray is
+	// straight until the first warp bends it, and a straight ray only
+	// passes what its tile's cone from the camera holds, so until then it
+	// tests the warps and the objects listed for its tile and no others.
+	// A tile with no warps listed has only straight rays, which the depth
+	// prepass and reprojection rely on.
+	//
+	// The objects culled are the ones map() tests at every point, the
+	// grid's global list: every sphere in a small scene, and the rooms,
+	// which are always listed. Larger scenes keep their spheres in the
+	// grid, whose cells already hold only what is near.
+	class ScreenTiles
+	{
+		std::vector<glm::vec4> bounds; // of the global objects, w -1 for rooms
+
+	public:
+		struct Pair
+		{
+			glm::vec3 a;
+			int indexA;
+			glm::vec3 b;
+			int indexB;
+			float influence;
+		};
+
+		int tileSize; // pixels per side
+		int tilesX, tilesY;
+		std::vector<Pair> pairs;
+		// Four ints per tile: the first entry in warpList and the count,
+		// then the same in objectList
+		std::vector<int> tiles;
+		std::vector<int> warpList;
+		// The grid's global list in full, for rays that are bent, then the
+		// tiles' lists. Object indices.
+		std::vector<int> objectList;
+		int globalCount;
+		ScreenTiles();
+		// For a width x height image seen from cameraPos along rotation, at
+		// the positions the scene is drawn at. grid is the one map() walks.
+		void build(Scene *scene, const SceneGrid &grid, glm::vec3 cameraPos, glm::vec2 rotation, int width, int height);
+		// Index into tiles of the tile holding a pixel
+		int tileAt(float x, float y) const;
+	};
+
+}
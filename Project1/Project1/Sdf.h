@@ -0,0 +1,280 @@
+#pragma once
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <glm.hpp>
+
+namespace rme
+{
+
+	// Combinators for static geometry. A tree such as
+	//
+	//   sdf::smoothUnion(sdf::translate(sdf::torus(glm::vec2(5.0, 0.8)), at), pillars, 1.0f)
+	//
+	// is one nested type, so calling it compiles to a single inlined
+	// expression with no per-object switch. glsl(p) writes the same tree as
+	// a GLSL expression in p using the functions of march.frag, so the CPU
+	// and the shader evaluate the same field. gradient(p) is the field's
+	// analytic gradient, not normalised, taken through the same tree.
+	namespace sdf
+	{
+
+		inline std::string glslFloat(float f)
+		{
+			char text[32];
+			std::sprintf(text, "%.9g", f);
+			// GLSL reads "1" as an int
+			if (!std::strpbrk(text, ".eEn")) std::strcat(text, ".0");
+			return text;
+		}
+
+		inline std::string glslVec2(glm::vec2 v)
+		{
+			return "vec2(" + glslFloat(v.x) + ", " + glslFloat(v.y) + ")";
+		}
+
+		inline std::string glslVec3(glm::vec3 v)
+		{
+			return "vec3(" + glslFloat(v.x) + ", " + glslFloat(v.y) + ", " + glslFloat(v.z) + ")";
+		}
+
+		// Gradient of a box of half size b, the same for rounded ones:
+		// straight out of the nearest face inside, towards p from the
+		// nearest point outside
+		inline glm::vec3 boxGradient(glm::vec3 p, glm::vec3 b)
+		{
+			glm::vec3 d = glm::abs(p) - b;
+			glm::vec3 s = glm::sign(p);
+			if (glm::max(d.x, glm::max(d.y, d.z)) > 0.0f) return s * glm::normalize(glm::max(d, glm::vec3(0.0f)));
+			if (d.x > d.y && d.x > d.z) return glm::vec3(s.x, 0.0f, 0.0f);
+			return d.y > d.z ? glm::vec3(0.0f, s.y, 0.0f) : glm::vec3(0.0f, 0.0f, s.z);
+		}
+
+		//// Primitives, as in march.frag ////
+
+		struct SphereShape
+		{
+			float radius;
+			float operator()(glm::vec3 p) const { return glm::length(p) - radius; }
+			glm::vec3 gradient(glm::vec3 p) const { return glm::normalize(p); }
+			std::string glsl(const std::string &p) const { return "sdSphere(" + p + ", " + glslFloat(radius) + ")"; }
+		};
+
+		struct TorusShape
+		{
+			glm::vec2 t;
+			float operator()(glm::vec3 p) const
+			{
+				glm::vec2 q = glm::vec2(glm::length(glm::vec2(p.x, p.y)) - t.x, p.z);
+				return glm::length(q) - t.y;
+			}
+			glm::vec3 gradient(glm::vec3 p) const
+			{
+				glm::vec2 xy = glm::vec2(p.x, p.y);
+				float ring = glm::length(xy);
+				glm::vec2 q = glm::vec2(ring - t.x, p.z);
+				glm::vec2 out = ring > 0.0f ? xy / ring : glm::vec2(0.0f);
+				return glm::vec3(out * q.x, q.y) / glm::length(q);
+			}
+			std::string glsl(const std::string &p) const { return "sdTorus(" + p + ", " + glslVec2(t) + ")"; }
+		};
+
+		struct RoundBoxShape
+		{
+			glm::vec3 b;
+			float r;
+			float operator()(glm::vec3 p) const
+			{
+				glm::vec3 d = glm::abs(p) - b;
+				return glm::min(glm::max(d.x, glm::max(d.y, d.z)), 0.0f) + glm::length(glm::max(d, glm::vec3(0.0f))) - r;
+			}
+			glm::vec3 gradient(glm::vec3 p) const { return boxGradient(p, b); }
+			std::string glsl(const std::string &p) const { return "sdRoundBox(" + p + ", " + glslVec3(b) + ", " + glslFloat(r) + ")"; }
+		};
+
+		struct BoxInteriorShape
+		{
+			glm::vec3 b;
+			float operator()(glm::vec3 p) const
+			{
+				glm::vec3 d = glm::abs(p) - b;
+				return -(glm::min(glm::max(d.x, glm::max(d.y, d.z)), 0.0f) + glm::length(glm::max(d, glm::vec3(0.0f))));
+			}
+			glm::vec3 gradient(glm::vec3 p) const { return -boxGradient(p, b); }
+			std::string glsl(const std::string &p) const { return "sdBoxInterior(" + p + ", " + glslVec3(b) + ")"; }
+		};
+
+		//// Operators ////
+
+		template <typename A, typename B>
+		struct Union
+		{
+			A a;
+			B b;
+			float operator()(glm::vec3 p) const { return glm::min(a(p), b(p)); }
+			glm::vec3 gradient(glm::vec3 p) const { return a(p) < b(p) ? a.gradient(p) : b.gradient(p); }
+			std::string glsl(const std::string &p) const { return "opU(" + a.glsl(p) + ", " + b.glsl(p) + ")"; }
+		};
+
+		// Polynomial smooth min, smin() in march.frag
+		template <typename A, typename B>
+		struct SmoothUnion
+		{
+			A a;
+			B b;
+			float k;
+			float operator()(glm::vec3 p) const
+			{
+				float da = a(p), db = b(p);
+				float h = glm::clamp(0.5f + 0.5f*(db - da) / k, 0.0f, 1.0f);
+				return glm::mix(db, da, h) - k*h*(1.0f - h);
+			}
+			// The terms from h's own gradient cancel
+			glm::vec3 gradient(glm::vec3 p) const
+			{
+				float h = glm::clamp(0.5f + 0.5f*(b(p) - a(p)) / k, 0.0f, 1.0f);
+				return h*a.gradient(p) + (1.0f - h)*b.gradient(p);
+			}
+			std::string glsl(const std::string &p) const { return "smin(" + a.glsl(p) + ", " + b.glsl(p) + ", " + glslFloat(k) + ")"; }
+		};
+
+		// a with b cut out of it
+		template <typename A, typename B>
+		struct Subtraction
+		{
+			A a;
+			B b;
+			float operator()(glm::vec3 p) const { return glm::max(a(p), -b(p)); }
+			glm::vec3 gradient(glm::vec3 p) const { return a(p) > -b(p) ? a.gradient(p) : -b.gradient(p); }
+			std::string glsl(const std::string &p) const { return "max(" + a.glsl(p) + ", -(" + b.glsl(p) + "))"; }
+		};
+
+		template <typename A, typename B>
+		struct Intersection
+		{
+			A a;
+			B b;
+			float operator()(glm::vec3 p) const { return glm::max(a(p), b(p)); }
+			glm::vec3 gradient(glm::vec3 p) const { return a(p) > b(p) ? a.gradient(p) : b.gradient(p); }
+			std::string glsl(const std::string &p) const { return "max(" + a.glsl(p) + ", " + b.glsl(p) + ")"; }
+		};
+
+		//// Transforms ////
+
+		template <typename E>
+		struct Translation
+		{
+			E e;
+			glm::vec3 offset;
+			float operator()(glm::vec3 p) const { return e(p - offset); }
+			glm::vec3 gradient(glm::vec3 p) const { return e.gradient(p - offset); }
+			std::string glsl(const std::string &p) const { return e.glsl("(" + p + " - " + glslVec3(offset) + ")"); }
+		};
+
+		// Turns e by angle about the y axis, rot2D() on xz as in march.frag
+		template <typename E>
+		struct RotationY
+		{
+			E e;
+			float angle;
+			float operator()(glm::vec3 p) const
+			{
+				float s = glm::sin(angle), c = glm::cos(angle);
+				glm::vec2 xz = glm::vec2(p.x, p.z) * glm::mat2(c, s, -s, c);
+				return e(glm::vec3(xz.x, p.y, xz.y));
+			}
+			// Turned back the other way
+			glm::vec3 gradient(glm::vec3 p) const
+			{
+				float s = glm::sin(angle), c = glm::cos(angle);
+				glm::vec2 xz = glm::vec2(p.x, p.z) * glm::mat2(c, s, -s, c);
+				glm::vec3 g = e.gradient(glm::vec3(xz.x, p.y, xz.y));
+				glm::vec2 gxz = glm::mat2(c, s, -s, c) * glm::vec2(g.x, g.z);
+				return glm::vec3(gxz.x, g.y, gxz.y);
+			}
+			std::string glsl(const std::string &p) const { return e.glsl("rotateY(" + p + ", " + glslFloat(angle) + ")"); }
+		};
+
+		// Uniform scale, which keeps the field a true distance
+		template <typename E>
+		struct Scaling
+		{
+			E e;
+			float s;
+			float operator()(glm::vec3 p) const { return e(p / s) * s; }
+			glm::vec3 gradient(glm::vec3 p) const { return e.gradient(p / s); }
+			std::string glsl(const std::string &p) const { return "(" + e.glsl("(" + p + " / " + glslFloat(s) + ")") + " * " + glslFloat(s) + ")"; }
+		};
+
+		//// Builders, so trees are written without spelling out their types ////
+
+		inline SphereShape sphere(float radius) { SphereShape s = { radius }; return s; }
+		inline TorusShape torus(glm::vec2 t) { TorusShape s = { t }; return s; }
+		inline RoundBoxShape roundBox(glm::vec3 b, float r) { RoundBoxShape s = { b, r }; return s; }
+		inline BoxInteriorShape boxInterior(glm::vec3 b) { BoxInteriorShape s = { b }; return s; }
+
+		template <typename A, typename B>
+		Union<A, B> unite(const A &a, const B &b) { Union<A, B> u = { a, b }; return u; }
+		template <typename A, typename B>
+		SmoothUnion<A, B> smoothUnion(const A &a, const B &b, float k) { SmoothUnion<A, B> u = { a, b, k }; return u; }
+		template <typename A, typename B>
+		Subtraction<A, B> subtract(const A &a, const B &b) { Subtraction<A, B> s = { a, b }; return s; }
+		template <typename A, typename B>
+		Intersection<A, B> intersect(const A &a, const B &b) { Intersection<A, B> i = { a, b }; return i; }
+		template <typename E>
+		Translation<E> translate(const E &e, glm::vec3 offset) { Translation<E> t = { e, offset }; return t; }
+		template <typename E>
+		RotationY<E> rotateY(const E &e, float angle) { RotationY<E> r = { e, angle }; return r; }
+		template <typename E>
+		Scaling<E> scale(const E &e, float s) { Scaling<E> t = { e, s }; return t; }
+
+	}
+
+	// A tree from sdf:: behind one indirect call, so Scene and the renderers
+	// can hold it without being templates themselves. glsl holds the
+	// staticExact() and staticColor that replace march.frag's defaults; the
+	// renderer follows it with a staticMap() reading it or a BrickMap.
+	class StaticSdf
+	{
+		void *tree;
+		float (*evaluate)(const void *tree, glm::vec3 p);
+		glm::vec3 (*differentiate)(const void *tree, glm::vec3 p);
+		void (*destroy)(void *tree);
+		StaticSdf(const StaticSdf&);
+		StaticSdf &operator=(const StaticSdf&);
+
+		template <typename E>
+		static float evaluateTree(const void *tree, glm::vec3 p) { return (*(const E*)tree)(p); }
+		template <typename E>
+		static glm::vec3 differentiateTree(const void *tree, glm::vec3 p) { return (*(const E*)tree).gradient(p); }
+		template <typename E>
+		static void destroyTree(void *tree) { delete (E*)tree; }
+
+	public:
+		glm::vec3 color;
+		std::string glsl;
+
+		template <typename E>
+		StaticSdf(const E &e, glm::vec3 c)
+		{
+			tree = new E(e);
+			evaluate = &evaluateTree<E>;
+			differentiate = &differentiateTree<E>;
+			destroy = &destroyTree<E>;
+			color = c;
+			glsl = "const vec3 staticColor = " + sdf::glslVec3(color) + ";\n"
+				"float staticExact(vec3 p)\n"
+				"{\n"
+				"\treturn " + e.glsl("p") + ";\n"
+				"}\n";
+		}
+
+		~StaticSdf() { destroy(tree); }
+
+		float distance(glm::vec3 p) const { return evaluate(tree, p); }
+		// Unit surface normal from the analytic gradient. The shader only
+		// has distance(), so the renderers take theirs from four taps of it.
+		glm::vec3 normal(glm::vec3 p) const { return glm::normalize(differentiate(tree, p)); }
+	};
+
+}
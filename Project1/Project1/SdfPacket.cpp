@@ -0,0 +1,161 @@
+#include "SdfPacket.h"
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RME_X86 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include "SdfPacketKernels.h"
+
+namespace rme
+{
+
+#ifdef RME_X86
+	// Defined in SdfPacketAvx2.cpp
+	extern const SdfKernels avx2Kernels;
+#endif
+
+	namespace
+	{
+
+		struct ScalarLanes
+		{
+			static const int width = 1;
+			float v;
+			static ScalarLanes make(float f) { ScalarLanes r; r.v = f; return r; }
+			static ScalarLanes load(const float* p) { return make(*p); }
+			static ScalarLanes loadEvery3(const float* p) { return make(*p); }
+			static ScalarLanes set(float f) { return make(f); }
+			void store(float* p) const { *p = v; }
+			static ScalarLanes min(ScalarLanes a, ScalarLanes b) { return make(a.v < b.v ? a.v : b.v); }
+			static ScalarLanes max(ScalarLanes a, ScalarLanes b) { return make(a.v > b.v ? a.v : b.v); }
+			static ScalarLanes abs(ScalarLanes a) { return make(std::fabs(a.v)); }
+			static ScalarLanes sqrt(ScalarLanes a) { return make(std::sqrt(a.v)); }
+			static ScalarLanes excluded(const int* exclude, int index) { return make(*exclude == index ? 1.0f : 0.0f); }
+			static ScalarLanes select(ScalarLanes mask, ScalarLanes a, ScalarLanes b) { return mask.v != 0.0f ? a : b; }
+		};
+		inline ScalarLanes operator+(ScalarLanes a, ScalarLanes b) { return ScalarLanes::make(a.v + b.v); }
+		inline ScalarLanes operator-(ScalarLanes a, ScalarLanes b) { return ScalarLanes::make(a.v - b.v); }
+		inline ScalarLanes operator*(ScalarLanes a, ScalarLanes b) { return ScalarLanes::make(a.v * b.v); }
+
+#ifdef RME_X86
+		struct SseLanes
+		{
+			static const int width = 4;
+			__m128 v;
+			static SseLanes make(__m128 m) { SseLanes r; r.v = m; return r; }
+			static SseLanes load(const float* p) { return make(_mm_loadu_ps(p)); }
+			static SseLanes loadEvery3(const float* p) { return make(_mm_setr_ps(p[0], p[3], p[6], p[9])); }
+			static SseLanes set(float f) { return make(_mm_set1_ps(f)); }
+			void store(float* p) const { _mm_storeu_ps(p, v); }
+			static SseLanes min(SseLanes a, SseLanes b) { return make(_mm_min_ps(a.v, b.v)); }
+			static SseLanes max(SseLanes a, SseLanes b) { return make(_mm_max_ps(a.v, b.v)); }
+			static SseLanes abs(SseLanes a) { return make(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)); }
+			static SseLanes sqrt(SseLanes a) { return make(_mm_sqrt_ps(a.v)); }
+			static SseLanes excluded(const int* exclude, int index)
+			{
+				__m128i e = _mm_loadu_si128((const __m128i*)exclude);
+				return make(_mm_castsi128_ps(_mm_cmpeq_epi32(e, _mm_set1_epi32(index))));
+			}
+			static SseLanes select(SseLanes mask, SseLanes a, SseLanes b)
+			{
+				return make(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)));
+			}
+		};
+		inline SseLanes operator+(SseLanes a, SseLanes b) { return SseLanes::make(_mm_add_ps(a.v, b.v)); }
+		inline SseLanes operator-(SseLanes a, SseLanes b) { return SseLanes::make(_mm_sub_ps(a.v, b.v)); }
+		inline SseLanes operator*(SseLanes a, SseLanes b) { return SseLanes::make(_mm_mul_ps(a.v, b.v)); }
+#endif
+
+		SimdLevel detectedLevel = detectSimdLevel();
+		SimdLevel activeLevel = detectedLevel;
+		const SdfKernels scalarKernels = {
+			ScalarLanes::width,
+			sphereKernel<ScalarLanes>,
+			boxInteriorKernel<ScalarLanes>,
+			torusKernel<ScalarLanes>,
+			roundBoxKernel<ScalarLanes>,
+			sphereSweepKernel<ScalarLanes>
+		};
+#ifdef RME_X86
+		const SdfKernels sseKernels = {
+			SseLanes::width,
+			sphereKernel<SseLanes>,
+			boxInteriorKernel<SseLanes>,
+			torusKernel<SseLanes>,
+			roundBoxKernel<SseLanes>,
+			sphereSweepKernel<SseLanes>
+		};
+#endif
+
+	}
+
+	SimdLevel detectSimdLevel()
+	{
+#ifdef RME_X86
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] >= 7)
+		{
+			__cpuid(info, 1);
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			bool avx = (info[2] & (1 << 28)) != 0;
+			__cpuidex(info, 7, 0);
+			bool avx2 = (info[1] & (1 << 5)) != 0;
+			// The OS has to save the YMM registers too
+			if (osxsave && avx && avx2 && (_xgetbv(0) & 6) == 6) return SIMD_AVX2;
+		}
+#else
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+#endif
+		return SIMD_SSE;
+#else
+		return SIMD_SCALAR;
+#endif
+	}
+
+	SimdLevel getSimdLevel()
+	{
+		return activeLevel;
+	}
+
+	void setSimdLevel(SimdLevel level)
+	{
+		activeLevel = level > detectedLevel ? detectedLevel : level;
+	}
+
+	const char* simdLevelName(SimdLevel level)
+	{
+		switch (level)
+		{
+		case SIMD_AVX2:
+			return "avx2";
+		case SIMD_SSE:
+			return "sse";
+		default:
+			return "scalar";
+		}
+	}
+
+	const SdfKernels& sdfKernels()
+	{
+#ifdef RME_X86
+		if (activeLevel == SIMD_AVX2) return avx2Kernels;
+		if (activeLevel == SIMD_SSE) return sseKernels;
+#endif
+		return scalarKernels;
+	}
+
+	const SdfKernels& sdfKernels(int points)
+	{
+		const SdfKernels &active = sdfKernels();
+		return points < active.width ? scalarKernels : active;
+	}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+namespace rme
+{
+
+	enum SimdLevel
+	{
+		SIMD_SCALAR,
+		SIMD_SSE,
+		SIMD_AVX2
+	};
+
+	// Structure-of-arrays batch of query points. A point whose exclude entry
+	// matches a primitive's index skips that primitive, like the exclude
+	// argument of Scene::map. exclude may be null.
+	struct PointPacket
+	{
+		const float *x, *y, *z;
+		const int *exclude;
+		int count;
+	};
+
+	// One Object3D worth of distance field parameters
+	struct SdfPrimitive
+	{
+		float position[3];
+		float shape[3];
+		float radius;
+		int index;
+	};
+
+	// Folds the primitive into dist[i] with min(), the union used by map()
+	typedef void(*SdfKernel)(const PointPacket &points, const SdfPrimitive &prim, float* dist);
+
+	// Nearest of count spheres to one point, with the lanes going across the
+	// spheres instead of across points. centres holds xyz triples
+	typedef float(*SdfSphereSweep)(const float* point, const float* centres, const float* radii, int count);
+
+	struct SdfKernels
+	{
+		int width;             // points per packet
+		SdfKernel sphere;      // radius
+		SdfKernel boxInterior; // shape = half extents
+		SdfKernel torus;       // shape.x = major, shape.y = minor radius
+		SdfKernel roundBox;    // shape = half extents, radius = rounding
+		SdfSphereSweep sphereSweep;
+	};
+
+	SimdLevel detectSimdLevel();
+	SimdLevel getSimdLevel();
+	// Anything above what the CPU supports is clamped to the detected level
+	void setSimdLevel(SimdLevel level);
+	const char* simdLevelName(SimdLevel level);
+	const SdfKernels& sdfKernels();
+	// A packet narrower than the active width would be mostly padding, so it
+	// gets the scalar kernels
+	const SdfKernels& sdfKernels(int points);
+
+}
@@ -0,0 +1,58 @@
+// AVX2 instantiation of the packet kernels. GCC and Clang build this file
+// with -mavx2; it is only called after detectSimdLevel() reports AVX2 support.
+#include "SdfPacket.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include "SdfPacketKernels.h"
+
+namespace rme
+{
+
+	namespace
+	{
+
+		struct Avx2Lanes
+		{
+			static const int width = 8;
+			__m256 v;
+			static Avx2Lanes make(__m256 m) { Avx2Lanes r; r.v = m; return r; }
+			static Avx2Lanes load(const float* p) { return make(_mm256_loadu_ps(p)); }
+			static Avx2Lanes loadEvery3(const float* p)
+			{
+				return make(_mm256_i32gather_ps(p, _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21), 4));
+			}
+			static Avx2Lanes set(float f) { return make(_mm256_set1_ps(f)); }
+			void store(float* p) const { _mm256_storeu_ps(p, v); }
+			static Avx2Lanes min(Avx2Lanes a, Avx2Lanes b) { return make(_mm256_min_ps(a.v, b.v)); }
+			static Avx2Lanes max(Avx2Lanes a, Avx2Lanes b) { return make(_mm256_max_ps(a.v, b.v)); }
+			static Avx2Lanes abs(Avx2Lanes a) { return make(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)); }
+			static Avx2Lanes sqrt(Avx2Lanes a) { return make(_mm256_sqrt_ps(a.v)); }
+			static Avx2Lanes excluded(const int* exclude, int index)
+			{
+				__m256i e = _mm256_loadu_si256((const __m256i*)exclude);
+				return make(_mm256_castsi256_ps(_mm256_cmpeq_epi32(e, _mm256_set1_epi32(index))));
+			}
+			static Avx2Lanes select(Avx2Lanes mask, Avx2Lanes a, Avx2Lanes b)
+			{
+				return make(_mm256_blendv_ps(b.v, a.v, mask.v));
+			}
+		};
+		inline Avx2Lanes operator+(Avx2Lanes a, Avx2Lanes b) { return Avx2Lanes::make(_mm256_add_ps(a.v, b.v)); }
+		inline Avx2Lanes operator-(Avx2Lanes a, Avx2Lanes b) { return Avx2Lanes::make(_mm256_sub_ps(a.v, b.v)); }
+		inline Avx2Lanes operator*(Avx2Lanes a, Avx2Lanes b) { return Avx2Lanes::make(_mm256_mul_ps(a.v, b.v)); }
+
+	}
+
+	// Constant-initialised so no AVX2 code runs before detection
+	extern const SdfKernels avx2Kernels = {
+		Avx2Lanes::width,
+		sphereKernel<Avx2Lanes>,
+		boxInteriorKernel<Avx2Lanes>,
+		torusKernel<Avx2Lanes>,
+		roundBoxKernel<Avx2Lanes>,
+		sphereSweepKernel<Avx2Lanes>
+	};
+
+}
+#endif
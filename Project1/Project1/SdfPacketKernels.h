@@ -0,0 +1,141 @@
+#pragma once
+#include "SdfPacket.h"
+#include <cmath>
+
+// Packet kernels written once against a lane type V and instantiated by
+// SdfPacket.cpp (scalar, SSE) and SdfPacketAvx2.cpp (AVX2). Everything is in an
+// anonymous namespace so the AVX2 copies stay private to their translation
+// unit. V provides width, load, loadEvery3, store, set, min, max, abs, sqrt,
+// select and excluded; arithmetic follows the same order as the scalar Scene::sd* code so
+// every level returns identical distances.
+
+namespace rme
+{
+	namespace
+	{
+
+		template <class V>
+		inline V lengthLanes(V x, V y, V z)
+		{
+			return V::sqrt(x*x + y*y + z*z);
+		}
+
+		template <class V, class Eval>
+		inline void runPacket(const PointPacket &points, const SdfPrimitive &prim, float* dist, Eval eval)
+		{
+			V cx = V::set(prim.position[0]);
+			V cy = V::set(prim.position[1]);
+			V cz = V::set(prim.position[2]);
+			int i = 0;
+			for (; i + V::width <= points.count; i += V::width)
+			{
+				V old = V::load(dist + i);
+				V result = V::min(eval(V::load(points.x + i) - cx, V::load(points.y + i) - cy, V::load(points.z + i) - cz), old);
+				if (points.exclude) result = V::select(V::excluded(points.exclude + i, prim.index), old, result);
+				result.store(dist + i);
+			}
+			if (i == points.count) return;
+
+			// Pad the tail into a full packet
+			float tx[V::width], ty[V::width], tz[V::width], td[V::width];
+			int te[V::width];
+			int tail = points.count - i;
+			for (int k = 0; k < V::width; k++)
+			{
+				int src = k < tail ? i + k : i;
+				tx[k] = points.x[src];
+				ty[k] = points.y[src];
+				tz[k] = points.z[src];
+				td[k] = dist[src];
+				te[k] = points.exclude ? points.exclude[src] : -1;
+			}
+			V old = V::load(td);
+			V result = V::min(eval(V::load(tx) - cx, V::load(ty) - cy, V::load(tz) - cz), old);
+			if (points.exclude) result = V::select(V::excluded(te, prim.index), old, result);
+			result.store(td);
+			for (int k = 0; k < tail; k++) dist[i + k] = td[k];
+		}
+
+		template <class V>
+		void sphereKernel(const PointPacket &points, const SdfPrimitive &prim, float* dist)
+		{
+			V s = V::set(prim.radius);
+			runPacket<V>(points, prim, dist, [s](V x, V y, V z) {
+				return lengthLanes(x, y, z) - s;
+			});
+		}
+
+		template <class V>
+		float sphereSweepKernel(const float* point, const float* centres, const float* radii, int count)
+		{
+			V px = V::set(point[0]);
+			V py = V::set(point[1]);
+			V pz = V::set(point[2]);
+			V nearest = V::set(1000000.0f);
+			int i = 0;
+			for (; i + V::width <= count; i += V::width)
+			{
+				const float* c = centres + 3 * i;
+				V d = lengthLanes(px - V::loadEvery3(c), py - V::loadEvery3(c + 1), pz - V::loadEvery3(c + 2)) - V::load(radii + i);
+				nearest = V::min(nearest, d);
+			}
+			float lanes[V::width];
+			nearest.store(lanes);
+			float dist = lanes[0];
+			for (int k = 1; k < V::width; k++) dist = lanes[k] < dist ? lanes[k] : dist;
+			for (; i < count; i++)
+			{
+				const float* c = centres + 3 * i;
+				float x = point[0] - c[0], y = point[1] - c[1], z = point[2] - c[2];
+				float d = std::sqrt(x*x + y*y + z*z) - radii[i];
+				dist = d < dist ? d : dist;
+			}
+			return dist;
+		}
+
+		template <class V>
+		void boxInteriorKernel(const PointPacket &points, const SdfPrimitive &prim, float* dist)
+		{
+			V bx = V::set(prim.shape[0]);
+			V by = V::set(prim.shape[1]);
+			V bz = V::set(prim.shape[2]);
+			runPacket<V>(points, prim, dist, [bx, by, bz](V x, V y, V z) {
+				V zero = V::set(0.0f);
+				V dx = V::abs(x) - bx;
+				V dy = V::abs(y) - by;
+				V dz = V::abs(z) - bz;
+				V inside = V::min(V::max(dx, V::max(dy, dz)), zero);
+				return zero - (inside + lengthLanes(V::max(dx, zero), V::max(dy, zero), V::max(dz, zero)));
+			});
+		}
+
+		template <class V>
+		void torusKernel(const PointPacket &points, const SdfPrimitive &prim, float* dist)
+		{
+			V tx = V::set(prim.shape[0]);
+			V ty = V::set(prim.shape[1]);
+			runPacket<V>(points, prim, dist, [tx, ty](V x, V y, V z) {
+				V qx = V::sqrt(x*x + y*y) - tx;
+				return V::sqrt(qx*qx + z*z) - ty;
+			});
+		}
+
+		template <class V>
+		void roundBoxKernel(const PointPacket &points, const SdfPrimitive &prim, float* dist)
+		{
+			V bx = V::set(prim.shape[0]);
+			V by = V::set(prim.shape[1]);
+			V bz = V::set(prim.shape[2]);
+			V r = V::set(prim.radius);
+			runPacket<V>(points, prim, dist, [bx, by, bz, r](V x, V y, V z) {
+				V zero = V::set(0.0f);
+				V dx = V::abs(x) - bx;
+				V dy = V::abs(y) - by;
+				V dz = V::abs(z) - bz;
+				V inside = V::min(V::max(dx, V::max(dy, dz)), zero);
+				return inside + lengthLanes(V::max(dx, zero), V::max(dy, zero), V::max(dz, zero)) - r;
+			});
+		}
+
+	}
+}
@@ -0,0 +1,238 @@
+#include "ShaderCache.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace rme
+{
+
+	static const char binaryMagic[8] = { 'R', 'M', 'E', 'P', 'R', 'O', 'G', '1' };
+
+	// FNV-1a, continued from hash
+	static unsigned long long hashBytes(unsigned long long hash, const char *bytes, size_t length)
+	{
+		for (size_t i = 0; i < length; i++)
+		{
+			hash ^= (unsigned char)bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static unsigned long long hashString(unsigned long long hash, const char *s)
+	{
+		// The terminator goes in too, so "ab" + "c" and "a" + "bc" differ
+		return hashBytes(hash, s ? s : "", s ? std::strlen(s) + 1 : 1);
+	}
+
+	ShaderCache::ShaderCache(GLFWwindow *w, const std::string &p)
+	{
+		window = w;
+		workerWindow = nullptr;
+		finished = false;
+		path = p;
+		key = 0;
+		building = 0;
+		startTime = 0.0;
+		program = 0;
+		fromCache = false;
+		buildTime = 0.0;
+	}
+
+	ShaderCache::~ShaderCache()
+	{
+		wait();
+		if (program) glDeleteProgram(program);
+	}
+
+	void ShaderCache::build(const std::string &vertex, const std::string &fragment)
+	{
+		wait();
+		if (program) glDeleteProgram(program);
+		program = 0;
+		fromCache = false;
+		startTime = glfwGetTime();
+		vertexSource = vertex;
+		fragmentSource = fragment;
+
+		// A driver update can change what a binary means without changing
+		// its format, so the driver strings are part of the key
+		key = 14695981039346656037ull;
+		key = hashString(key, vertexSource.c_str());
+		key = hashString(key, fragmentSource.c_str());
+		key = hashString(key, (const char*)glGetString(GL_VENDOR));
+		key = hashString(key, (const char*)glGetString(GL_RENDERER));
+		key = hashString(key, (const char*)glGetString(GL_VERSION));
+
+		if (readBinary())
+		{
+			fromCache = true;
+			buildTime = glfwGetTime() - startTime;
+			return;
+		}
+
+		// GLFW only creates windows on the main thread, so the worker's
+		// context is made here and handed over
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+		workerWindow = glfwCreateWindow(1, 1, "", nullptr, window);
+		glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+		if (!workerWindow)
+		{
+			std::cout << "Could not create a shader compile context, compiling on the main thread\n";
+			compile();
+			program = building;
+			buildTime = glfwGetTime() - startTime;
+			return;
+		}
+
+		finished = false;
+		worker = std::thread([this]() {
+			glfwMakeContextCurrent(workerWindow);
+			compile();
+			// The program has to be complete before the main context uses it
+			glFinish();
+			glfwMakeContextCurrent(nullptr);
+			finished = true;
+		});
+	}
+
+	bool ShaderCache::poll()
+	{
+		if (program) return true;
+		if (!worker.joinable() || !finished) return false;
+		finish();
+		return true;
+	}
+
+	void ShaderCache::wait()
+	{
+		if (worker.joinable()) finish();
+	}
+
+	void ShaderCache::finish()
+	{
+		worker.join();
+		glfwDestroyWindow(workerWindow);
+		workerWindow = nullptr;
+		program = building;
+		buildTime = glfwGetTime() - startTime;
+	}
+
+	void ShaderCache::compile()
+	{
+		const GLchar* vertexShaderSource = (const GLchar *)vertexSource.c_str();
+		const GLchar* fragmentShaderSource = (const GLchar *)fragmentSource.c_str();
+
+		// Vertex shader
+		GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
+		glCompileShader(vertexShader);
+		// Check for compile time errors
+		GLint success;
+		GLchar infoLog[512];
+		glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
+			std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+		}
+		// Fragment shader
+		GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
+		glCompileShader(fragmentShader);
+		// Check for compile time errors
+		glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
+			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+		}
+		// Link shaders
+		building = glCreateProgram();
+		glProgramParameteri(building, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glAttachShader(building, vertexShader);
+		glAttachShader(building, fragmentShader);
+		glLinkProgram(building);
+		// Check for linking errors
+		glGetProgramiv(building, GL_LINK_STATUS, &success);
+		if (!success) {
+			glGetProgramInfoLog(building, 512, NULL, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+		}
+		glDeleteShader(vertexShader);
+		glDeleteShader(fragmentShader);
+		if (!success) return;
+
+		GLint length = 0;
+		glGetProgramiv(building, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) return; // the driver keeps no binaries
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(building, length, &length, &format, &binary[0]);
+		binary.resize(length);
+		writeBinary(format, binary);
+	}
+
+	bool ShaderCache::readBinary()
+	{
+		FILE *file = std::fopen(path.c_str(), "rb");
+		if (!file) return false;
+		char magic[8];
+		unsigned long long fileKey = 0;
+		unsigned int format = 0, length = 0;
+		bool ok = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+			std::memcmp(magic, binaryMagic, sizeof(magic)) == 0 &&
+			std::fread(&fileKey, sizeof(fileKey), 1, file) == 1 &&
+			std::fread(&format, sizeof(format), 1, file) == 1 &&
+			std::fread(&length, sizeof(length), 1, file) == 1 &&
+			fileKey == key && length > 0;
+		std::vector<char> binary;
+		if (ok)
+		{
+			binary.resize(length);
+			ok = std::fread(&binary[0], 1, length, file) == length;
+		}
+		std::fclose(file);
+		if (!ok) return false;
+
+		GLuint loaded = glCreateProgram();
+		glProgramBinary(loaded, format, &binary[0], length);
+		GLint success;
+		glGetProgramiv(loaded, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			std::cout << "Cached shader program " << path << " was rejected, recompiling\n";
+			glDeleteProgram(loaded);
+			return false;
+		}
+		program = loaded;
+		return true;
+	}
+
+	void ShaderCache::writeBinary(GLenum format, const std::vector<char> &binary)
+	{
+		// Written beside the final name and renamed over it, so a reader
+		// never sees half a file
+		std::string temporary = path + ".tmp";
+		FILE *file = std::fopen(temporary.c_str(), "wb");
+		if (!file)
+		{
+			std::printf("Could not write shader cache %s\n", temporary.c_str());
+			return;
+		}
+		unsigned int fileFormat = format, length = binary.size();
+		bool ok = std::fwrite(binaryMagic, 1, sizeof(binaryMagic), file) == sizeof(binaryMagic) &&
+			std::fwrite(&key, sizeof(key), 1, file) == 1 &&
+			std::fwrite(&fileFormat, sizeof(fileFormat), 1, file) == 1 &&
+			std::fwrite(&length, sizeof(length), 1, file) == 1 &&
+			std::fwrite(&binary[0], 1, length, file) == length;
+		std::fclose(file);
+		std::remove(path.c_str());
+		if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0)
+		{
+			std::printf("Could not write shader cache %s\n", path.c_str());
+			std::remove(temporary.c_str());
+		}
+	}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+namespace rme
+{
+
+	// Builds a vertex/fragment program without holding up the window. A
+	// binary from glGetProgramBinary is kept on disk, keyed by a hash of both
+	// sources and the driver's vendor, renderer and version strings, and is
+	// loaded straight away when the key matches. Otherwise the shaders are
+	// compiled on a worker thread with its own context, shared with the
+	// window's, and the new binary replaces the old one.
+	class ShaderCache
+	{
+		GLFWwindow *window;
+		GLFWwindow *workerWindow;
+		std::thread worker;
+		std::atomic<bool> finished;
+		std::string path;
+		std::string vertexSource, fragmentSource;
+		unsigned long long key;
+		GLuint building;
+		double startTime;
+		bool readBinary();
+		void writeBinary(GLenum format, const std::vector<char> &binary);
+		void compile();
+		void finish();
+
+	public:
+		GLuint program; // 0 until the program is ready
+		bool fromCache;
+		double buildTime; // seconds from build() until the program was ready
+		// path is the cache file for this program
+		ShaderCache(GLFWwindow *window, const std::string &path);
+		~ShaderCache();
+		// Must be called with window's context current
+		void build(const std::string &vertex, const std::string &fragment);
+		// True once program can be used; cheap to call every frame
+		bool poll();
+		// Blocks until program can be used
+		void wait();
+	};
+
+}
@@ -0,0 +1,198 @@
+#include "SimClock.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+// Filled by the window callbacks, drained by whoever steps the scene
+rme::InputQueue *inputQueue = new rme::InputQueue(1024);
+
+namespace rme
+{
+
+	SimClock::SimClock(double step)
+	{
+		stepTime = step;
+		accumulator = 0.0;
+		lastTime = 0.0;
+		started = false;
+		maxSteps = 25;
+		ticks = 0;
+	}
+
+	int SimClock::advance(double now)
+	{
+		if (!started)
+		{
+			// The first frame draws the initial state
+			lastTime = now;
+			started = true;
+			return 0;
+		}
+		accumulator += now - lastTime;
+		lastTime = now;
+		int steps = 0;
+		while (accumulator >= stepTime && steps < maxSteps)
+		{
+			accumulator -= stepTime;
+			steps++;
+		}
+		// Whatever could not be caught up on is dropped
+		if (accumulator >= stepTime) accumulator = std::fmod(accumulator, stepTime);
+		ticks += steps;
+		return steps;
+	}
+
+	float SimClock::alpha()
+	{
+		return float(accumulator / stepTime);
+	}
+
+	double SimClock::getStepTime()
+	{
+		return stepTime;
+	}
+
+	InputQueue::InputQueue(int capacity)
+	{
+		unsigned int size = 1;
+		while (size < (unsigned int)capacity) size *= 2;
+		slots.resize(size);
+		mask = size - 1;
+		head = 0;
+		tail = 0;
+		dropped = 0;
+	}
+
+	bool InputQueue::push(const InputEvent &event)
+	{
+		unsigned int h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) > mask)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		slots[h & mask] = event;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool InputQueue::pop(InputEvent &event)
+	{
+		unsigned int t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire)) return false;
+		event = slots[t & mask];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	void InputQueue::drain(Controls &controls)
+	{
+		InputEvent event;
+		while (pop(event))
+		{
+			switch (event.kind) {
+			case INPUT_KEY:
+				controls.interpretKey(event.code, event.action);
+				break;
+			case INPUT_BUTTON:
+				controls.interpretMouseButton(event.code, event.action);
+				break;
+			case INPUT_MOVE:
+				controls.interpretMouseMove(event.x, event.y);
+				break;
+			}
+		}
+	}
+
+	static const char logMagic[8] = { 'R', 'M', 'E', 'I', 'N', 'P', 'T', '1' };
+
+	void InputLog::clear()
+	{
+		frames.clear();
+	}
+
+	int InputLog::size()
+	{
+		return frames.size();
+	}
+
+	void InputLog::record(const Controls &controls)
+	{
+		InputFrame frame;
+		frame.buttons = (controls.w ? 1 : 0) | (controls.a ? 2 : 0) | (controls.s ? 4 : 0) |
+			(controls.d ? 8 : 0) | (controls.space ? 16 : 0) | (controls.lmb ? 32 : 0);
+		frame.xRotation = controls.xRotation;
+		frame.yRotation = controls.yRotation;
+		frames.push_back(frame);
+	}
+
+	bool InputLog::replay(long long tick, Controls &controls)
+	{
+		if (tick < 0 || tick >= (long long)frames.size()) return false;
+		const InputFrame &frame = frames[tick];
+		controls.w = (frame.buttons & 1) != 0;
+		controls.a = (frame.buttons & 2) != 0;
+		controls.s = (frame.buttons & 4) != 0;
+		controls.d = (frame.buttons & 8) != 0;
+		controls.space = (frame.buttons & 16) != 0;
+		controls.lmb = (frame.buttons & 32) != 0;
+		controls.xRotation = frame.xRotation;
+		controls.yRotation = frame.yRotation;
+		return true;
+	}
+
+	bool InputLog::save(const char* filename)
+	{
+		FILE *file = std::fopen(filename, "wb");
+		if (!file)
+		{
+			std::printf("Could not write input log %s\n", filename);
+			return false;
+		}
+		// Fields are written one at a time so struct padding never reaches the file
+		unsigned int count = frames.size();
+		bool ok = std::fwrite(logMagic, 1, sizeof(logMagic), file) == sizeof(logMagic) &&
+			std::fwrite(&count, sizeof(count), 1, file) == 1;
+		for (int i = 0; ok && i < frames.size(); i++)
+		{
+			ok = std::fwrite(&frames[i].buttons, 1, 1, file) == 1 &&
+				std::fwrite(&frames[i].xRotation, sizeof(float), 1, file) == 1 &&
+				std::fwrite(&frames[i].yRotation, sizeof(float), 1, file) == 1;
+		}
+		std::fclose(file);
+		if (!ok) std::printf("Could not write input log %s\n", filename);
+		return ok;
+	}
+
+	bool InputLog::load(const char* filename)
+	{
+		FILE *file = std::fopen(filename, "rb");
+		if (!file)
+		{
+			std::printf("Could not open input log %s\n", filename);
+			return false;
+		}
+		char magic[8];
+		unsigned int count = 0;
+		bool ok = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+			std::memcmp(magic, logMagic, sizeof(magic)) == 0 &&
+			std::fread(&count, sizeof(count), 1, file) == 1;
+		frames.clear();
+		for (unsigned int i = 0; ok && i < count; i++)
+		{
+			InputFrame frame;
+			ok = std::fread(&frame.buttons, 1, 1, file) == 1 &&
+				std::fread(&frame.xRotation, sizeof(float), 1, file) == 1 &&
+				std::fread(&frame.yRotation, sizeof(float), 1, file) == 1;
+			if (ok) frames.push_back(frame);
+		}
+		std::fclose(file);
+		if (!ok)
+		{
+			std::printf("Input log %s is not valid\n", filename);
+			frames.clear();
+		}
+		return ok;
+	}
+
+}
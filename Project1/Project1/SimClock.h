@@ -0,0 +1,87 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include "Control.h"
+
+#define INPUT_KEY 0
+#define INPUT_BUTTON 1
+#define INPUT_MOVE 2
+
+namespace rme
+{
+
+	// Fixed timestep accumulator. Wall time goes in, a whole number of
+	// simulation steps comes out, and alpha() says how far between the last
+	// two steps the frame should be drawn.
+	class SimClock
+	{
+		double stepTime;
+		double accumulator;
+		double lastTime;
+		bool started;
+
+	public:
+		// Steps per advance() are capped so a long stall (a breakpoint, a
+		// window drag) does not turn into a burst of catch-up steps
+		int maxSteps;
+		long long ticks; // steps handed out so far
+		SimClock(double stepTime);
+		// Returns how many steps to run for the wall clock reading now
+		int advance(double now);
+		float alpha();
+		double getStepTime();
+	};
+
+	// The parts of Controls the simulation reads, for one tick
+	struct InputFrame
+	{
+		unsigned char buttons; // w, a, s, d, space, lmb from bit 0 up
+		float xRotation, yRotation;
+	};
+
+	// One window callback, kept for the thread that steps the scene
+	struct InputEvent
+	{
+		int kind; // INPUT_KEY, INPUT_BUTTON or INPUT_MOVE
+		int code, action; // scancode or button, and what happened to it
+		double x, y; // cursor position for INPUT_MOVE
+	};
+
+	// Fixed size queue from the thread polling the window to the one
+	// stepping the scene, built like Profiler's SampleRing: neither side
+	// locks or waits, and a push onto a full queue is dropped and counted.
+	class InputQueue
+	{
+		std::vector<InputEvent> slots;
+		unsigned int mask;
+		std::atomic<unsigned int> head; // next slot to write, owned by the producer
+		std::atomic<unsigned int> tail; // next slot to read, owned by the consumer
+
+	public:
+		std::atomic<int> dropped;
+		// capacity is rounded up to a power of two
+		InputQueue(int capacity);
+		bool push(const InputEvent &event);
+		bool pop(InputEvent &event);
+		// Applies every queued event to controls in the order they came
+		void drain(Controls &controls);
+	};
+
+	// Controls state captured before every step, so a run can be repeated
+	// bit for bit from the same starting scene
+	class InputLog
+	{
+		std::vector<InputFrame> frames;
+
+	public:
+		void clear();
+		int size();
+		void record(const Controls &controls);
+		// Overwrites controls with the state recorded for tick; false once
+		// the log has run out
+		bool replay(long long tick, Controls &controls);
+		bool save(const char* filename);
+		bool load(const char* filename);
+	};
+
+}
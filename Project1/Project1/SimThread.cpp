@@ -0,0 +1,135 @@
+#include "SimThread.h"
+
+extern Controls *control;
+extern rme::InputQueue *inputQueue;
+
+namespace rme
+{
+
+	SimThread::SimThread(Scene *s, Camera *c, double step, Profiler *p) : clock(step)
+	{
+		scene = s;
+		camera = c;
+		profiler = p;
+		stepTime = step;
+		stepsPerSecond = glm::max(1, int(1.0 / step + 0.5));
+		epoch = std::chrono::steady_clock::now();
+		for (int i = 0; i < 3; i++)
+		{
+			frames[i].scene = new Scene();
+			frames[i].camera = new Camera(camera->name);
+			frames[i].time = 0.0;
+			frames[i].stepsRun = 0;
+		}
+		back = 0;
+		front = 1;
+		middle = 2;
+		stopping = false;
+		done = false;
+		replayLog = nullptr;
+		recordLog = nullptr;
+		checkpointFile = nullptr;
+		checkpointSteps = 0;
+		startTick = 0;
+		measureForceError = false;
+		stepsRun = 0;
+	}
+
+	SimThread::~SimThread()
+	{
+		stop();
+		for (int i = 0; i < 3; i++)
+		{
+			delete frames[i].scene;
+			delete frames[i].camera;
+		}
+	}
+
+	double SimThread::now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	void SimThread::start()
+	{
+		// The first frame draws the starting state
+		double time = now();
+		clock.advance(time);
+		publish(time);
+		stopping = false;
+		thread = std::thread(&SimThread::run, this);
+	}
+
+	void SimThread::stop()
+	{
+		stopping = true;
+		if (thread.joinable()) thread.join();
+	}
+
+	bool SimThread::finished()
+	{
+		return done.load();
+	}
+
+	void SimThread::run()
+	{
+		while (!stopping.load(std::memory_order_relaxed))
+		{
+			inputQueue->drain(*control);
+			double time = now();
+			int steps = clock.advance(time);
+			bool ended = false;
+			for (int i = 0; i < steps && !ended; i++) ended = !step();
+			if (steps > 0) publish(time - clock.alpha() * stepTime);
+			if (ended)
+			{
+				done = true;
+				return;
+			}
+			// Wakes when the next step is due; a late wake is caught up on
+			// by the clock
+			std::this_thread::sleep_for(std::chrono::duration<double>((1.0 - clock.alpha()) * stepTime));
+		}
+	}
+
+	bool SimThread::step()
+	{
+		if (replayLog)
+		{
+			if (!replayLog->replay(stepsRun, *control)) return false;
+		}
+		else if (recordLog) recordLog->record(*control);
+		double start = profiler ? profiler->now() : 0.0;
+		scene->update();
+		if (profiler) profiler->lap(STAGE_UPDATE, start);
+		stepsRun++;
+		if (checkpointFile && checkpointSteps > 0 && stepsRun % checkpointSteps == 0) scene->saveSnapshot(checkpointFile, startTick + stepsRun);
+		if (measureForceError && stepsRun % stepsPerSecond == 0) scene->measureForceError();
+		return true;
+	}
+
+	void SimThread::publish(double time)
+	{
+		SceneFrame &frame = frames[back];
+		scene->copyDrawState(frame.scene);
+		frame.camera->slot = camera->slot;
+		frame.camera->position = camera->position;
+		frame.time = time;
+		frame.stepsRun = stepsRun;
+		back = middle.exchange(back | FRAME_FRESH, std::memory_order_acq_rel) & ~FRAME_FRESH;
+	}
+
+	SceneFrame* SimThread::latest()
+	{
+		if (middle.load(std::memory_order_acquire) & FRAME_FRESH)
+		{
+			front = middle.exchange(front, std::memory_order_acq_rel) & ~FRAME_FRESH;
+		}
+		SceneFrame &frame = frames[front];
+		// A finished replay shows its final state, as -cpu does
+		if (done.load()) frame.scene->renderAlpha = 1.0f;
+		else frame.scene->renderAlpha = glm::clamp(float((now() - frame.time) / stepTime), 0.0f, 1.0f);
+		return &frame;
+	}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "rme.h"
+#include "SimClock.h"
+#include "Profiler.h"
+
+// Set on SimThread::middle while the frame there has not been taken
+#define FRAME_FRESH 4
+
+namespace rme
+{
+
+	// The scene as of one batch of steps, for the renderers only. Never
+	// written while the render thread holds it.
+	struct SceneFrame
+	{
+		Scene *scene; // a copy, see Scene::copyDrawState
+		Camera *camera; // slot points into scene
+		double time; // clock reading the newest step in it was due at
+		long long stepsRun;
+	};
+
+	// Steps a scene on its own thread at a fixed rate, so the simulation
+	// never waits on vsync and runs beside the GPU. Window input reaches it
+	// through inputQueue. After every batch of steps it copies what is drawn
+	// into a triple buffer: the simulation fills the back frame and swaps it
+	// with the middle one, the render thread swaps its front frame with the
+	// middle one when a newer one is there, and neither ever waits.
+	class SimThread
+	{
+		Scene *scene;
+		Camera *camera;
+		Profiler *profiler;
+		SimClock clock;
+		double stepTime;
+		int stepsPerSecond;
+		std::chrono::steady_clock::time_point epoch;
+		SceneFrame frames[3];
+		int back; // owned by the simulation
+		int front; // owned by the render thread
+		std::atomic<int> middle; // frame index, with FRAME_FRESH
+		std::thread thread;
+		std::atomic<bool> stopping;
+		std::atomic<bool> done;
+		double now();
+		void run();
+		bool step();
+		void publish(double time);
+
+	public:
+		// Set before start(). A replay log feeds the controls for every step
+		// and ends the run once it runs out; a record log is filled.
+		InputLog *replayLog;
+		InputLog *recordLog;
+		// Written every checkpointSteps steps, numbered from startTick
+		const char* checkpointFile;
+		int checkpointSteps;
+		long long startTick;
+		// Compares Barnes-Hut against the exact forces every second of steps
+		bool measureForceError;
+		// Steps taken, read once stop() has returned
+		long long stepsRun;
+		SimThread(Scene *scene, Camera *camera, double stepTime, Profiler *profiler);
+		~SimThread();
+		void start();
+		// Waits for the current batch of steps to finish
+		void stop();
+		// True once a replay has run out; its final state is published first
+		bool finished();
+		// Newest published frame, with renderAlpha set for the time now.
+		// Left alone by the simulation until the next call.
+		SceneFrame* latest();
+	};
+
+}
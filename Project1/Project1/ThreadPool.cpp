@@ -0,0 +1,93 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace rme
+{
+
+	ThreadPool::ThreadPool(int threads)
+	{
+		if (threads <= 0)
+			threads = std::max(1, (int)std::thread::hardware_concurrency());
+		next = 0;
+		jobCount = 0;
+		busy = 0;
+		generation = 0;
+		stopping = false;
+		for (int i = 1; i < threads; i++)
+		{
+			workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (int i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+	}
+
+	int ThreadPool::size()
+	{
+		return workers.size() + 1;
+	}
+
+	void ThreadPool::parallelFor(int count, std::function<void(int index, int worker)> fn)
+	{
+		if (count <= 0) return;
+		if (workers.empty() || count == 1)
+		{
+			for (int i = 0; i < count; i++) fn(i, 0);
+			return;
+		}
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			job = fn;
+			jobCount = count;
+			next = 0;
+			busy = workers.size();
+			generation++;
+		}
+		wake.notify_all();
+
+		runJob(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return busy == 0; });
+		job = nullptr;
+	}
+
+	void ThreadPool::runJob(int worker)
+	{
+		for (int i = next++; i < jobCount; i = next++)
+		{
+			job(i, worker);
+		}
+	}
+
+	void ThreadPool::workerLoop(int worker)
+	{
+		unsigned int seen = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+				if (stopping) return;
+				seen = generation;
+			}
+			runJob(worker);
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				busy--;
+			}
+			done.notify_one();
+		}
+	}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace rme
+{
+
+	// Persistent worker threads for data-parallel loops. The calling thread
+	// joins in as worker 0, so a pool of size 1 runs everything inline.
+	class ThreadPool
+	{
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		std::function<void(int, int)> job;
+		std::atomic<int> next;
+		int jobCount;
+		int busy;
+		unsigned int generation;
+		bool stopping;
+		void workerLoop(int worker);
+		void runJob(int worker);
+
+	public:
+		// threads <= 0 uses every hardware thread
+		ThreadPool(int threads);
+		~ThreadPool();
+		int size();
+		// Calls fn(index, worker) for every index in [0, count), handing out
+		// indices dynamically, and returns once all of them have finished.
+		void parallelFor(int count, std::function<void(int index, int worker)> fn);
+	};
+
+}
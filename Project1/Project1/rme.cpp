@@ -1,448 +1,620 @@
 
 #include "rme.h"
 #include "Control.h"
+#include <chrono>
+#include <cmath>
 
 Controls *control = new Controls();
 
 namespace rme
 {
 
-	RaymarchRenderer::RaymarchRenderer(int w, int h)
-	{
-		width = w;
-		height = h;
-
-		// Init GLFW
-		glfwInit();
-		// Set all the required options for GLFW
-		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-		glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-		
-		// Create a GLFWwindow object that we can use for GLFW's functions
-		window = glfwCreateWindow(width, height, "Time", nullptr, nullptr);
-		glfwMakeContextCurrent(window);
-
-		// Disable mouse 
-		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-
-		// Set the required callback functions
-		glfwSetKeyCallback(window, key_callback);
-		glfwSetCursorPosCallback(window, cursor_pos_callback);
-		glfwSetMouseButtonCallback(window, mouse_button_callback);
-
-		// Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
-		glewExperimental = GL_TRUE;
-		// Initialize GLEW to setup the OpenGL Function pointers
-		glewInit();
-		
-		// get version info
-		const GLubyte* hardware = glGetString(GL_RENDERER); // get renderer string
-		const GLubyte* version = glGetString(GL_VERSION); // version as a string
-		printf("Hardware: %s\n", hardware);
-		printf("OpenGL version supported %s\n", version);
-
-		// Define the viewport dimensions
-		int width, height;
-		glfwGetFramebufferSize(window, &width, &height);
-		glViewport(0, 0, width, height);
-
-		// Load shaders
-		std::string vert = loadSource("shaders/pass.vert");
-		std::string frag = loadSource("shaders/march.frag");
-		//std::printf("source: %s\n", vert.c_str());
-		const GLchar* vertexShaderSource = (const GLchar *)vert.c_str();
-		const GLchar* fragmentShaderSource = (const GLchar *)frag.c_str();
-
-		// Build and compile our shader program
-		// Vertex shader
-		GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-		glCompileShader(vertexShader);
-		// Check for compile time errors
-		GLint success;
-		GLchar infoLog[512];
-		glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-		if (!success)
-		{
-			glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-		}
-		// Fragment shader
-		GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-		glCompileShader(fragmentShader);
-		// Check for compile time errors
-		glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-		if (!success)
-		{
-			glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-		}
-		// Link shaders
-		shaderProgram = glCreateProgram();
-		glAttachShader(shaderProgram, vertexShader);
-		glAttachShader(shaderProgram, fragmentShader);
-		glLinkProgram(shaderProgram);
-		// Check for linking errors
-		glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-		if (!success) {
-			glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-		}
-		glDeleteShader(vertexShader);
-		glDeleteShader(fragmentShader);
-
-
-		// Set up vertex data (and buffer(s)) and attribute pointers
-		//GLfloat vertices[] = {
-		//  // First triangle
-		//   0.5f,  0.5f,  // Top Right
-		//   0.5f, -0.5f,  // Bottom Right
-		//  -0.5f,  0.5f,  // Top Left 
-		//  // Second triangle
-		//   0.5f, -0.5f,  // Bottom Right
-		//  -0.5f, -0.5f,  // Bottom Left
-		//  -0.5f,  0.5f   // Top Left
-		//}; 
-		GLfloat vertices[] = {
-			1.0f, 1.0f, 0.0f,  // Top Right
-			1.0f, -1.0f, 0.0f,  // Bottom Right
-			-1.0f, -1.0f, 0.0f,  // Bottom Left
-			-1.0f, 1.0f, 0.0f   // Top Left 
-		};
-		GLuint indices[] = {  // Note that we start from 0!
-			0, 1, 3,  // First Triangle
-			1, 2, 3   // Second Triangle
-		};
-		//GLuint VBO, VAO, EBO;
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
-		// Bind the Vertex Array Object first, then bind and set vertex buffer(s) and attribute pointer(s).
-		glBindVertexArray(VAO);
-
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
-		glEnableVertexAttribArray(0);
-
-		glBindBuffer(GL_ARRAY_BUFFER, 0); // Note that this is allowed, the call to 
-		// glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
-
-		glBindVertexArray(0); // Unbind VAO (it's always a good thing to unbind any 
-		// buffer/array to prevent strange bugs), remember: do NOT unbind the EBO, keep it bound to this VAO
-
-		timeLocation = glGetUniformLocation(shaderProgram, "time");
-		resolutionLocation = glGetUniformLocation(shaderProgram, "resolution");
-		objCountLocation = glGetUniformLocation(shaderProgram, "objectCount");
-		rotationLocation = glGetUniformLocation(shaderProgram, "cameraRotation");
-		camPosLocation = glGetUniformLocation(shaderProgram, "cameraPos");
-
-		warpALoc = glGetUniformLocation(shaderProgram, "warpA");
-		warpBLoc = glGetUniformLocation(shaderProgram, "warpB");
-
-		warpCountLoc = glGetUniformLocation(shaderProgram, "warpCount");
-
-		glUseProgram(shaderProgram);
-
-		glUniform2f(resolutionLocation, (GLfloat)width, (GLfloat)height);
-
-		glUniform1i(objCountLocation, 0);
-
-		glUniform2f(rotationLocation, 0.0, 0.0);
-
-		objectLocations = new shaderObject3D[MAX_OBJECTS];
-
-		for (int i = 0; i < MAX_OBJECTS; i++)
-		{
-		///	shaderObject3D *current = 
-			objectLocations[i].position = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].position").c_str());
-			objectLocations[i].direction = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].direction").c_str());
-			objectLocations[i].radius = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].radius").c_str());
-			objectLocations[i].age = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].age").c_str());
-			objectLocations[i].shape = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].shape").c_str());
-			objectLocations[i].geometry = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].geometry").c_str());
-			objectLocations[i].mass = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].mass").c_str());
-			objectLocations[i].shininess = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].shiniess").c_str());
-			objectLocations[i].luminance = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].luminance").c_str());
-			objectLocations[i].color = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].color").c_str());
-			objectLocations[i].shading = glGetUniformLocation(shaderProgram, ("objects[" + std::to_string(i) + "].shading").c_str());
-		}
+	Scene::Scene()
+	{
+		//control();
+		broadPhase = new BroadPhase(4.0);
+		useBroadPhase = true;
+		forceSolver = FORCE_EXACT;
+		theta = 0.5;
+		barnesHut = new BarnesHut(theta);
+		forceStats.bodies = 0;
+		forceStats.buildTime = 0.0;
+		forceStats.solveTime = 0.0;
+		forceStats.rmsError = 0.0;
+		forceStats.maxError = 0.0;
+		updating = false;
+		pool = nullptr;
+		renderAlpha = 1.0;
+		viewRotation = glm::vec2(0.0);
+		staticGeometry = nullptr;
+		staticBake = nullptr;
+		launchWarps = 1;
+		warpInfluence = 16.0;
+		unpairedLaunch.id = -1;
+		unpairedLaunch.generation = 0;
+	}
 
-		glfwSetTime(0.0);
+	Scene::~Scene()
+	{
+		delete broadPhase;
+		delete barnesHut;
+	}
+
+	void Scene::add(Object3D *obj)
+	{
+		addObject(*obj, obj);
+	}
 
+	void Scene::addObject(const Object3D &desc, Object3D *owner)
+	{
+		objects.add(desc, owner);
+		// update() registers the moved objects again at their new indices
+		previousPosition.clear();
+		refreshWarps();
 	}
 
-	void RaymarchRenderer::render(Scene* scene, Camera* camera)
+	ObjectHandle Scene::place(const Object3D &desc)
 	{
-		// Check if any events have been activiated (key pressed, mouse moved etc.) 
-		// and call corresponding response functions
-		glfwPollEvents();
+		addObject(desc, nullptr);
+		return objects.handle(objects.moved[objects.movedCount - 1]);
+	}
 
-		// Render
-		// Clear the colorbuffer
-		glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT);
-			
-		// Update uniforms with Scene
-		
-		updateUniforms(scene, camera);
+	void Scene::sync(Object3D *obj)
+	{
+		if (obj->slot >= 0) objects.read(obj->slot, *obj);
+	}
 
-		glUniform1f(timeLocation, float(glfwGetTime()));
+	void Scene::commit(Object3D *obj)
+	{
+		if (obj->slot >= 0) objects.write(obj->slot, *obj);
+	}
 
-		// Draw our first triangle
-		glUseProgram(shaderProgram);
-		glBindVertexArray(VAO);
-	//	glDrawArrays(GL_TRIANGLES, 0, 6);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-		
-		// Swap the screen buffers
-		glfwSwapBuffers(window);
+	bool Scene::attach(Object3D *obj)
+	{
+		int index = objects.find(obj->name);
+		if (index < 0) return false;
+		if (objects.owner[index]) objects.owner[index]->slot = -1;
+		objects.owner[index] = obj;
+		obj->slot = index;
+		objects.read(index, *obj);
+		return true;
+	}
 
+	void Scene::refreshBounds(int index)
+	{
+		glm::vec3 position = objects.position[index];
+		float radius = objects.radius[index];
+		switch (objects.geometry[index]) {
+		case SPHERE:
+			broadPhase->update(index, true, position - glm::vec3(radius), position + glm::vec3(radius));
+			break;
+		case BOX_INTERIOR:
+			broadPhase->update(index, false, glm::vec3(0.0), glm::vec3(0.0));
+			break;
+		default:
+			// Not part of map()
+			broadPhase->remove(index);
+		}
 	}
 
-	void RaymarchRenderer::updateUniforms(Scene* scene, Camera* camera)
+	void Scene::remove(std::string name)
 	{
-		glUniform2f(rotationLocation, control->xRotation, control->yRotation);
-		glUniform3f(camPosLocation, camera->position.x, camera->position.y, camera->position.z);
-		int size = scene->children.size();
-		glUniform1i(objCountLocation, size);
-		int warps = 0;
-		for (int i = 0; i < size; i++)
+		int index = objects.find(name);
+		if (index < 0)
 		{
-			Object3D *currentObj = scene->children[i];
-			if (currentObj->geometry == SPHERE)
-			{
-				if (warps == 0) glUniform3f(warpALoc, currentObj->position.x, currentObj->position.y, currentObj->position.z);
-				if (warps == 1) glUniform3f(warpBLoc, currentObj->position.x, currentObj->position.y, currentObj->position.z);
-				warps++;
-			}
-			shaderObject3D currentLoc = objectLocations[i];
-			glUniform3f(currentLoc.position, currentObj->position.x, currentObj->position.y, currentObj->position.z);
-			glUniform3f(currentLoc.direction, currentObj->direction.x, currentObj->direction.y, currentObj->direction.z);
-			glUniform1f(currentLoc.radius, currentObj->radius);
-			glUniform1f(currentLoc.age, currentObj->age);
-			glUniform3f(currentLoc.shape, currentObj->shape.x, currentObj->shape.y, currentObj->shape.z);
-			glUniform1i(currentLoc.geometry, currentObj->geometry);
-			glUniform1f(currentLoc.mass, currentObj->mass);
-		//	glUniform1f(currentLoc.shininess, currentObj->material->shininess);
-		//	glUniform1f(currentLoc.luminance, currentObj->material->luminance);
-			glUniform3f(currentLoc.color, currentObj->color.x, currentObj->color.y, currentObj->color.z);
-		//	glUniform1i(currentLoc.shading, currentObj->material->shading);
+			std::cout << "Object to remove does not exist\n";
+		}
+		else
+		{
+			removeAt(index);
 		}
-		
-		glUniform1i(warpCountLoc, warps);
 	}
 
-	std::string RaymarchRenderer::loadSource(char* filename)
+	bool Scene::remove(ObjectHandle handle)
 	{
-		std::ifstream infile{ filename };
-		return{ std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>() };
+		int index = objects.indexOf(handle);
+		if (index < 0) return false;
+		removeAt(index);
+		return true;
 	}
 
-	RaymarchRenderer::~RaymarchRenderer()
+	void Scene::removeAt(int index)
 	{
-		// Properly de-allocate all resources once they've outlived their purpose
-		glDeleteVertexArrays(1, &VAO);
-		glDeleteBuffers(1, &VBO);
-		glDeleteBuffers(1, &EBO);
-		delete objectLocations;
-		// Terminate GLFW, clearing any resources allocated by GLFW.
-		glfwTerminate();
+		objects.erase(index);
+		// The last index moved went away; the others are registered again
+		// by update()
+		broadPhase->remove(objects.moved[objects.movedCount - 1]);
+		previousPosition.clear();
+		refreshWarps();
 	}
 
-	void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode)
+	void Scene::linkWarps(ObjectHandle a, ObjectHandle b, float influence)
 	{
-		if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
-			glfwSetWindowShouldClose(window, GL_TRUE);
-		control->interpretKey(scancode, action);
-		std::printf("keypress: %i  scancode: %i  action: %i  mode: %i\n", key, scancode, action, mode);
+		WarpPair pair = { a, b, influence };
+		warps.push_back(pair);
+		refreshWarps();
 	}
 
-	void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+	void Scene::refreshWarps()
 	{
-		std::cout << "button: " << button << " action : " << action << "\n";
-		control->interpretMouseButton(button, action);
+		warpLinks.clear();
+		int kept = 0;
+		for (int n = 0; n < warps.size(); n++)
+		{
+			WarpLink link = { objects.indexOf(warps[n].a), objects.indexOf(warps[n].b), warps[n].influence };
+			if (link.a < 0 || link.b < 0) continue;
+			warps[kept++] = warps[n];
+			warpLinks.push_back(link);
+		}
+		warps.resize(kept);
 	}
 
-	static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
+	void Scene::spawn(Camera* camera)
 	{
-		//std::cout << "xpos: " << xpos << " ypos: " << ypos << "\n";
-		control->interpretMouseMove(xpos, ypos);
+		if (camera->slot >= 0) spawnFrom(camera->slot);
 	}
 
-	Scene::Scene()
+	void Scene::spawnFrom(int index)
 	{
-		std::vector<Object3D*> children;
-		//control();
+		// No name, so launching one never touches the name index
+		Sphere sphere("");
+		glm::vec2 yRot = rot2D(glm::vec2(0.0, 1.0), control->yRotation);
+		glm::vec2 xRot = rot2D(glm::vec2(0.0, yRot.y), control->xRotation);
+		glm::vec3 dir = glm::normalize(glm::vec3(xRot.x, yRot.x, xRot.y));
+
+		sphere.color = glm::vec3(0.0, 1.0, 0.0);
+		//sphere->material->color = glm::vec3(0.0, 1.0, 0.0);
+		sphere.radius = 2.75;
+		sphere.position = objects.position[index] + 1.1f*sphere.radius*dir;
+		sphere.charge = 0.0;
+		sphere.velocity = dir*0.07f;
+		sphere.physics = true;
+		if (updating) pendingSpawns.push_back(sphere);
+		else launch(sphere);
 	}
 
-	void Scene::add(Object3D *obj)
+	void Scene::launch(const Object3D &sphere)
 	{
-		children.push_back(obj);
+		ObjectHandle handle = place(sphere);
+		if (warps.size() >= launchWarps) return;
+		if (unpairedLaunch.id < 0)
+		{
+			unpairedLaunch = handle;
+		}
+		else
+		{
+			linkWarps(unpairedLaunch, handle, warpInfluence);
+			unpairedLaunch.id = -1;
+		}
 	}
 
-	void Scene::remove(std::string name)
+	void Scene::parallelRange(int count, std::function<void(int begin, int end, int worker)> fn)
 	{
-		int index = -1;
-		int count = 0;
-		for (std::vector<Object3D*>::iterator it = children.begin(); it != children.end(); ++it)
+		// Blocks keep the per-index dispatch cost small next to the work
+		const int block = 64;
+		if (pool == nullptr || count <= block)
 		{
-			if (children[count]->name == name)
+			fn(0, count, 0);
+			return;
+		}
+		int blocks = (count + block - 1) / block;
+		pool->parallelFor(blocks, [&](int b, int worker) {
+			fn(b*block, glm::min(count, (b + 1)*block), worker);
+		});
+	}
+
+	void Scene::update()
+	{
+		int count = objects.size();
+		int workers = pool ? pool->size() : 1;
+		if (scratch.size() < workers) scratch.resize(workers);
+		viewRotation = glm::vec2(control->xRotation, control->yRotation);
+
+		// Positions may have been set from outside since the last step
+		for (int i = 0; i < count; i++) refreshBounds(i);
+
+		computeChargeForces();
+
+		// Without the broad phase, collision distances for every object come
+		// from one packet query against the start-of-step state
+		int batchCount = useBroadPhase ? 0 : count;
+		if (batchCount > 0)
+		{
+			packetX.resize(batchCount);
+			packetY.resize(batchCount);
+			packetZ.resize(batchCount);
+			packetExclude.resize(batchCount);
+			packetDist.resize(batchCount);
+			for (int i = 0; i < batchCount; i++)
 			{
-				index = count;
-				break;
+				packetX[i] = objects.position[i].x;
+				packetY[i] = objects.position[i].y;
+				packetZ[i] = objects.position[i].z;
+				packetExclude[i] = i;
 			}
-			count++;
+			parallelRange(batchCount, [&](int begin, int end, int /*worker*/) {
+				PointPacket batch = { &packetX[begin], &packetY[begin], &packetZ[begin], &packetExclude[begin], end - begin };
+				mapPacket(batch, &packetDist[begin]);
+			});
 		}
-		if (index < 0)
+
+		updating = true;
+		nextPosition.resize(count);
+		nextVelocity.resize(count);
+
+		// Cameras read the controls and may spawn, so they stay on this thread
+		int camerasEnd = objects.groupEnd(CAMERA);
+		for (int i = objects.groupBegin(CAMERA); i < camerasEnd; i++)
 		{
-			std::cout << "Object to remove does not exist\n";
+			stepCamera(i);
 		}
-		else
+		parallelRange(count, [&](int begin, int end, int worker) {
+			for (int i = begin; i < end; i++)
+			{
+				if (objects.geometry[i] != CAMERA) stepObject(i, worker);
+			}
+		});
+
+		previousPosition = objects.position;
+		objects.position.swap(nextPosition);
+		objects.velocity.swap(nextVelocity);
+
+		updating = false;
+		for (int i = 0; i < pendingSpawns.size(); i++)
 		{
-			children.erase(children.begin() + count);
+			launch(pendingSpawns[i]);
 		}
+		pendingSpawns.clear();
 	}
 
-	void Scene::spawn(Camera* camera)
+	void Scene::copyDrawState(Scene *to)
 	{
-		Sphere *sphere = new rme::Sphere("sphere");
-		glm::vec2 yRot = rot2D(glm::vec2(0.0, 1.0), control->yRotation);
-		glm::vec2 xRot = rot2D(glm::vec2(0.0, yRot.y), control->xRotation);
-		glm::vec3 dir = glm::normalize(glm::vec3(xRot.x, yRot.x, xRot.y));
+		to->objects.copyDrawn(objects);
+		to->previousPosition = previousPosition;
+		to->viewRotation = viewRotation;
+		to->warpLinks = warpLinks;
+		to->staticGeometry = staticGeometry;
+		to->staticBake = staticBake;
+		to->forceStats = forceStats;
+	}
 
-		sphere->color = glm::vec3(0.0, 1.0, 0.0);
-		//sphere->material->color = glm::vec3(0.0, 1.0, 0.0);
-		sphere->radius = 2.75;
-		sphere->position = camera->position + 1.1f*sphere->radius*dir;
-		sphere->charge = 0.0;
-		sphere->velocity = dir*0.07f;
-		sphere->physics = true;
-		this->add(sphere);
+	glm::vec3 Scene::renderPosition(int i)
+	{
+		if (previousPosition.size() != objects.size()) return objects.position[i];
+		glm::vec3 previous = previousPosition[i];
+		return previous + (objects.position[i] - previous)*renderAlpha;
 	}
 
-	void Scene::update()
+	void Scene::stepCamera(int i)
 	{
-		// Collision detection and interaction
-		for (int i = 0; i < children.size(); i++)
+		// Camera collides but does not feel force
+		glm::vec3 position = objects.position[i];
+		glm::vec3 velocity = objects.velocity[i];
+		float radius = objects.radius[i];
+		objects.age[i] += 1.0;
+		if (objects.physics[i]) {
+			velocity += glm::vec3(0.0, -0.0005, 0.0);
+		}
+
+		// Move player with WASD
+		glm::vec2 direction = rot2D(glm::vec2(0.0, 1.0), control->xRotation);
+		glm::vec2 directionPerp = rot2D(glm::vec2(1.0, 0.0), control->xRotation);
+
+		glm::vec3 candidate = position + velocity;
+		float testDist;
+		glm::vec3 camNorm;
+		if (useBroadPhase)
+		{
+			// Exact wherever the result is used, i.e. within radius
+			std::vector<int> &candidates = scratch[0].candidates;
+			candidates.clear();
+			broadPhase->query(candidate, radius, candidates, scratch[0].stamps);
+			testDist = map(candidate, i, candidates.data(), candidates.size());
+			camNorm = normal(candidate, i, candidates.data(), candidates.size());
+		}
+		else
+		{
+			testDist = map(candidate, i);
+			camNorm = normal(candidate, i);
+		}
+		if (testDist < radius)
 		{
-			Object3D *current = children[i];
 
-			current->age += 1.0;
+			if (control->w) velocity +=  0.002f*glm::vec3(direction.x, 0.0, direction.y);
+			if (control->a) velocity += -0.002f*glm::vec3(directionPerp.x, 0.0, directionPerp.y);
+			if (control->s) velocity += -0.002f*glm::vec3(direction.x, 0.0, direction.y);
+			if (control->d) velocity +=  0.002f*glm::vec3(directionPerp.x, 0.0, directionPerp.y);
 
-			if (current->physics) {
-				current->velocity += glm::vec3(0.0, -0.0005, 0.0);
+		//	if (glm::dot(camNorm, glm::vec3(0.0, 1.0, 0.0)) > 0.0)
+		//	{
+				velocity = 0.97f*(velocity - glm::dot(velocity, camNorm)*camNorm);
+		//	}
+			if (control->space && glm::dot(camNorm, glm::vec3(0.0, 1.0, 0.0)) > 0.7)
+			{
+				velocity += glm::vec3(0.0, 0.06, 0.0);
+				position += velocity;
 			}
 
-			// Camera collides but does not feel force
-			if (current->geometry == CAMERA)
-			{
-				// Move player with WASD
-				glm::vec2 direction = rot2D(glm::vec2(0.0, 1.0), control->xRotation);
-				glm::vec2 directionPerp = rot2D(glm::vec2(1.0, 0.0), control->xRotation);
-
-				glm::vec3 candidate = current->position + current->velocity;
-				float testDist = map(candidate, i);
-				glm::vec3 camNorm = normal(candidate, i);
-				if (testDist < current->radius)
-				{
+		}
 
-					if (control->w) current->velocity +=  0.002f*glm::vec3(direction.x, 0.0, direction.y);
-					if (control->a) current->velocity += -0.002f*glm::vec3(directionPerp.x, 0.0, directionPerp.y);
-					if (control->s) current->velocity += -0.002f*glm::vec3(direction.x, 0.0, direction.y);
-					if (control->d) current->velocity +=  0.002f*glm::vec3(directionPerp.x, 0.0, directionPerp.y);
-
-				//	if (glm::dot(camNorm, glm::vec3(0.0, 1.0, 0.0)) > 0.0)
-				//	{
-						current->velocity = 0.97f*(current->velocity - glm::dot(current->velocity, camNorm)*camNorm);
-				//	}
-					if (control->space && glm::dot(camNorm, glm::vec3(0.0, 1.0, 0.0)) > 0.7)
-					{
-						current->velocity += glm::vec3(0.0, 0.06, 0.0);
-						current->position += current->velocity;
-					}
+		if (control->lmb)
+		{
+			spawnFrom(i);
+			control->lmb = false;
+		}
 
-				}
+		integrate(i, position, velocity);
+	}
 
-				if (control->lmb)
-				{
-					spawn((Camera*)current);
-					control->lmb = false;
-				}
+	void Scene::stepObject(int i, int worker)
+	{
+		glm::vec3 position = objects.position[i];
+		glm::vec3 velocity = objects.velocity[i];
+		float radius = objects.radius[i];
+		objects.age[i] += 1.0;
+		if (objects.physics[i]) {
+			velocity += glm::vec3(0.0, -0.0005, 0.0);
+		}
 
-			}
-			
-			if (current->geometry != SPHERE) continue;
-			
+		if (objects.geometry[i] == SPHERE)
+		{
 			// Electromagnetic/Gravity like force
-			for (int j = 0; j < children.size(); j++)
+			velocity += chargeForces[i];
+
+			// Collision detection
+			float distance;
+			std::vector<int> &candidates = scratch[worker].candidates;
+			if (useBroadPhase)
 			{
-				Object3D *other = children[j];
-				if (other->geometry != SPHERE || i == j) continue;
-				glm::vec3 diff = current->position - other->position;
-				float radius = glm::length(diff);
-				float force = current->charge*other->charge / (radius*radius);
-				current->velocity += diff * force;
+				candidates.clear();
+				broadPhase->query(position, radius, candidates, scratch[worker].stamps);
+				distance = map(position, i, candidates.data(), candidates.size());
 			}
-		
-			// Collision detection
-			float distance = map(current->position, i);
-			float delta = distance - current->radius;
+			else
+			{
+				distance = packetDist[i];
+			}
+			float delta = distance - radius;
 			// Collision
-			if (delta < 0.0f && current->collisions)
+			if (delta < 0.0f && objects.collisions[i])
 			{
-				glm::vec3 norm = glm::vec3(normal(current->position, i));
-				current->velocity = 1.0f*glm::reflect(current->velocity, norm);
+				glm::vec3 norm = useBroadPhase ? normal(position, i, candidates.data(), candidates.size()) : normal(position, i);
+				velocity = 1.0f*glm::reflect(velocity, norm);
 			//	current->correction += -1.0f*delta*glm::normalize(current->velocity);
 			}
-		
 		}
 
-		// Update positions
-		for (int i = 0; i < children.size(); i++)
+		integrate(i, position, velocity);
+	}
+
+	void Scene::integrate(int i, glm::vec3 position, glm::vec3 velocity)
+	{
+		velocity *= 0.99;
+		nextVelocity[i] = velocity;
+		nextPosition[i] = position + (velocity + objects.correction[i]);
+		objects.correction[i] = glm::vec3(0.0);
+	}
+
+	glm::vec3 Scene::exactChargeForce(int index)
+	{
+		glm::vec3 position = objects.position[index];
+		float charge = objects.charge[index];
+		glm::vec3 total = glm::vec3(0.0);
+		int last = objects.groupEnd(SPHERE);
+		for (int j = objects.groupBegin(SPHERE); j < last; j++)
 		{
-			Object3D *current = children[i];
-			current->velocity *= 0.99;
-			current->position += (current->velocity + current->correction);
-			current->correction = glm::vec3(0.0);
+			if (index == j) continue;
+			glm::vec3 diff = position - objects.position[j];
+			float radius = glm::length(diff);
+			float force = charge*objects.charge[j] / (radius*radius);
+			total += diff * force;
+		}
+		return total;
+	}
+
+	void Scene::buildChargeTree()
+	{
+		// The sphere group is already contiguous, so it is the body list
+		int first = objects.groupBegin(SPHERE);
+		int bodies = objects.groupEnd(SPHERE) - first;
+		barnesHut->theta = theta;
+		barnesHut->build(bodies > 0 ? &objects.position[first] : nullptr, bodies > 0 ? &objects.charge[first] : nullptr, bodies);
+	}
+
+	void Scene::computeChargeForces()
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		int first = objects.groupBegin(SPHERE);
+		int last = objects.groupEnd(SPHERE);
+		chargeForces.assign(objects.size(), glm::vec3(0.0));
+		forceStats.buildTime = 0.0;
+		forceStats.bodies = last - first;
+		if (forceSolver == FORCE_BARNES_HUT)
+		{
+			buildChargeTree();
+			std::chrono::high_resolution_clock::time_point built = std::chrono::high_resolution_clock::now();
+			forceStats.buildTime = std::chrono::duration<double>(built - start).count();
+			start = built;
+			parallelRange(last - first, [&](int begin, int end, int /*worker*/) {
+				for (int k = begin; k < end; k++)
+				{
+					int i = first + barnesHut->body(k);
+					chargeForces[i] = objects.charge[i] * barnesHut->field(objects.position[i], i - first);
+				}
+			});
+		}
+		else
+		{
+			parallelRange(last - first, [&](int begin, int end, int /*worker*/) {
+				for (int i = first + begin; i < first + end; i++)
+				{
+					chargeForces[i] = exactChargeForce(i);
+				}
+			});
 		}
+		forceStats.solveTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
 
+	void Scene::measureForceError()
+	{
+		buildChargeTree();
+		double sumSq = 0.0;
+		float maxError = 0.0;
+		int samples = 0;
+		int first = objects.groupBegin(SPHERE);
+		int last = objects.groupEnd(SPHERE);
+		for (int i = first; i < last; i++)
+		{
+			glm::vec3 exact = exactChargeForce(i);
+			glm::vec3 approx = objects.charge[i] * barnesHut->field(objects.position[i], i - first);
+			float magnitude = glm::length(exact);
+			if (magnitude == 0.0f) continue;
+			float error = glm::length(approx - exact) / magnitude;
+			sumSq += error*error;
+			maxError = glm::max(maxError, error);
+			samples++;
+		}
+		forceStats.rmsError = samples > 0 ? (float)std::sqrt(sumSq / samples) : 0.0f;
+		forceStats.maxError = maxError;
 	}
 
 	float Scene::map(glm::vec3 p, int exclude)
 	{
-			float dist = 1000000.0;
-			for (int i = 0; i < children.size(); i++) {
-				if (i == exclude) continue;
-				switch (children[i]->geometry) {
-				case 4:
-					dist = glm::min(dist, sdSphere(p - children[i]->position, children[i]->radius));
-					break;
-				case 7:
-					dist = glm::min(dist, sdBoxInterior(p - children[i]->position, children[i]->shape));
-					break;
-				default:
-					dist = dist;
+		float dist = 1000000.0;
+		int spheresEnd = objects.groupEnd(SPHERE);
+		int boxesEnd = objects.groupEnd(BOX_INTERIOR);
+		for (int i = objects.groupBegin(SPHERE); i < spheresEnd; i++) {
+			if (i == exclude) continue;
+			dist = glm::min(dist, sdSphere(p - objects.position[i], objects.radius[i]));
+		}
+		for (int i = objects.groupBegin(BOX_INTERIOR); i < boxesEnd; i++) {
+			if (i == exclude) continue;
+			dist = glm::min(dist, sdBoxInterior(p - objects.position[i], objects.shape[i]));
+		}
+		if (staticGeometry) dist = glm::min(dist, staticDistance(p));
+		return dist;
+	}
+
+	float Scene::map(glm::vec3 p, int exclude, const int* subset, int subsetCount)
+	{
+		float dist;
+		PointPacket point = { &p.x, &p.y, &p.z, &exclude, 1 };
+		mapPacket(point, &dist, subset, subsetCount);
+		return dist;
+	}
+
+	void Scene::mapPacket(const PointPacket &points, float* dist, const int* subset, int subsetCount)
+	{
+		const SdfKernels &kernels = sdfKernels(points.count);
+		for (int k = 0; k < points.count; k++) dist[k] = 1000000.0;
+
+		if (subsetCount < 0)
+		{
+			int spheresBegin = objects.groupBegin(SPHERE);
+			int spheresEnd = objects.groupEnd(SPHERE);
+			int boxesEnd = objects.groupEnd(BOX_INTERIOR);
+			if (points.count == 1 && spheresEnd > spheresBegin)
+			{
+				// One point: sweep the sphere group a vector of spheres at a time,
+				// in two runs either side of the excluded one
+				float p[3] = { points.x[0], points.y[0], points.z[0] };
+				int skip = points.exclude ? points.exclude[0] : -1;
+				int split = skip >= spheresBegin && skip < spheresEnd ? skip : spheresEnd;
+				const float* centres = &objects.position[0].x;
+				const float* radii = &objects.radius[0];
+				SdfSphereSweep sweep = sdfKernels().sphereSweep;
+				dist[0] = glm::min(dist[0], sweep(p, centres + 3 * spheresBegin, radii + spheresBegin, split - spheresBegin));
+				if (split < spheresEnd) dist[0] = glm::min(dist[0], sweep(p, centres + 3 * (split + 1), radii + split + 1, spheresEnd - split - 1));
+			}
+			else
+			{
+				for (int i = spheresBegin; i < spheresEnd; i++)
+				{
+					SdfPrimitive prim = { { objects.position[i].x, objects.position[i].y, objects.position[i].z }, { 0.0f, 0.0f, 0.0f }, objects.radius[i], i };
+					kernels.sphere(points, prim, dist);
 				}
 			}
-			return dist;
+			for (int i = objects.groupBegin(BOX_INTERIOR); i < boxesEnd; i++)
+			{
+				SdfPrimitive prim = { { objects.position[i].x, objects.position[i].y, objects.position[i].z }, { objects.shape[i].x, objects.shape[i].y, objects.shape[i].z }, 0.0f, i };
+				kernels.boxInterior(points, prim, dist);
+			}
+			mapStatic(points, dist);
+			return;
+		}
+
+		for (int n = 0; n < subsetCount; n++)
+		{
+			int i = subset[n];
+			SdfKernel kernel;
+			switch (objects.geometry[i]) {
+			case SPHERE:
+				kernel = kernels.sphere;
+				break;
+			case BOX_INTERIOR:
+				kernel = kernels.boxInterior;
+				break;
+			default:
+				continue;
+			}
+			SdfPrimitive prim = {
+				{ objects.position[i].x, objects.position[i].y, objects.position[i].z },
+				{ objects.shape[i].x, objects.shape[i].y, objects.shape[i].z },
+				objects.radius[i],
+				i
+			};
+			kernel(points, prim, dist);
+		}
+		mapStatic(points, dist);
 	}
 
-	glm::vec3 Scene::normal(glm::vec3 p, int exclude)
+	void Scene::mapStatic(const PointPacket &points, float* dist)
 	{
-		glm::vec3 eps = glm::vec3(0.002, 0.0, 0.0);
-		return glm::normalize(glm::vec3(
-			map(p + glm::vec3(eps.x, eps.y, eps.y), exclude) - map(p - glm::vec3(eps.x, eps.y, eps.y), exclude),
-			map(p + glm::vec3(eps.y, eps.x, eps.y), exclude) - map(p - glm::vec3(eps.y, eps.x, eps.y), exclude),
-			map(p + glm::vec3(eps.y, eps.y, eps.x), exclude) - map(p - glm::vec3(eps.y, eps.y, eps.x), exclude)));
+		if (!staticGeometry) return;
+		// Not excludable, it is not an object
+		for (int k = 0; k < points.count; k++)
+		{
+			glm::vec3 p = glm::vec3(points.x[k], points.y[k], points.z[k]);
+			dist[k] = glm::min(dist[k], staticDistance(p));
+		}
+	}
+
+	float Scene::staticDistance(glm::vec3 p)
+	{
+		return staticBake ? staticBake->distance(p) : staticGeometry->distance(p);
+	}
+
+	glm::vec3 Scene::normal(glm::vec3 p, int exclude, const int* subset, int subsetCount)
+	{
+		// The gradient of whichever surface is nearest, found in one pass
+		float dist = 1000000.0f;
+		int nearest = -1;
+		int count = subsetCount < 0 ? objects.size() : subsetCount;
+		for (int n = 0; n < count; n++)
+		{
+			int i = subsetCount < 0 ? n : subset[n];
+			if (i == exclude) continue;
+			float d;
+			switch (objects.geometry[i]) {
+			case SPHERE:
+				d = sdSphere(p - objects.position[i], objects.radius[i]);
+				break;
+			case BOX_INTERIOR:
+				d = sdBoxInterior(p - objects.position[i], objects.shape[i]);
+				break;
+			default:
+				continue;
+			}
+			if (d < dist) {
+				dist = d;
+				nearest = i;
+			}
+		}
+		if (staticGeometry && staticDistance(p) < dist) return staticGeometry->normal(p);
+		// Nothing to push against
+		if (nearest < 0) return glm::vec3(0.0f);
+		if (objects.geometry[nearest] == SPHERE) return glm::normalize(p - objects.position[nearest]);
+		return -sdf::boxGradient(p - objects.position[nearest], objects.shape[nearest]);
 	}
 
 	glm::vec2 Scene::rot2D(glm::vec2 p, float angle)
@@ -502,6 +674,7 @@ namespace rme
 		collisions = true;
 		physics = false;
 		color = glm::vec3(1.0, 1.0, 1.0);
+		slot = -1;
 	//	material = new Material();
 	}
 
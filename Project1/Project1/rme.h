@@ -1,18 +1,18 @@
-
+#pragma once
 #include <vector>
 #include <glm.hpp>
 #include <string>
+#include <unordered_map>
 #include <iostream>
 #include <fstream>
 
-#include "control.h"
-
-// GLEW
-//#define GLEW_STATIC
-#include <GL/glew.h>
-
-// GLFW
-#include <GLFW/glfw3.h>
+#include "Control.h"
+#include "SdfPacket.h"
+#include "BroadPhase.h"
+#include "BarnesHut.h"
+#include "ThreadPool.h"
+#include "Sdf.h"
+#include "BrickMap.h"
 
 #define CONTAINER  0
 #define CAMERA 1
@@ -23,8 +23,8 @@
 #define BOX 6
 #define BOX_INTERIOR 7
 #define TORUS 8
+#define GEOMETRY_TYPES 9
 
-#define MAX_OBJECTS 20
 #define UNIFORMS_PER_OBJECT 10
 
 namespace rme
@@ -62,24 +62,10 @@ namespace rme
 		std::vector<Object3D> children;
 		glm::vec3 color;
 	//	Material *material;
+		int slot; // index in the ObjectStore of the Scene it was added to, -1 if none
 		Object3D(std::string n);
 	};
 
-	struct shaderObject3D {
-		GLuint position; //vec3
-		GLuint direction; //vec3
-		//GLuint translation; //mat4
-		GLuint radius; //float
-		GLuint age; //float
-		GLuint shape; //vec3
-		GLuint geometry; //int
-		GLuint mass; //float
-		GLuint shininess; //float
-		GLuint luminance; //float
-		GLuint color; //vec3
-		GLuint shading; //int
-	};
-
 	class Camera :public Object3D
 	{
 	public:
@@ -99,48 +85,228 @@ namespace rme
 		BoxInterior(std::string n);
 	};
 
+	// Names one object for as long as it exists. Its index changes as other
+	// objects come and go; once it is removed the generation stops matching,
+	// so a stale handle finds nothing rather than whatever took its place.
+	struct ObjectHandle
+	{
+		int id; // -1 for none
+		unsigned int generation;
+	};
+
+	// Two objects, spheres in practice, where a ray going into one comes
+	// out of the other. Rays passing within influence of either end are
+	// bent towards it.
+	struct WarpPair
+	{
+		ObjectHandle a, b;
+		float influence;
+	};
+
+	// A WarpPair by object index, as the renderers draw it
+	struct WarpLink
+	{
+		int a, b;
+		float influence;
+	};
+
+	// Contiguous per-field storage for every object in a Scene. Objects are
+	// kept grouped by geometry, group g occupying [groupBegin(g), groupEnd(g)),
+	// so hot loops can walk a single primitive type without dispatch.
+	// Adding and removing move at most one object per later group, so both
+	// are O(1), but the order within a group is not kept. Once the fields
+	// have grown, neither allocates.
+	class ObjectStore
+	{
+		int groupStart[GEOMETRY_TYPES + 1];
+		// Per handle id
+		std::vector<int> indexOfId;
+		std::vector<unsigned int> generationOfId;
+		std::vector<int> freeIds;
+		// Objects with a name, to the id of the first added under it
+		struct NameEntry
+		{
+			int id;
+			int count; // objects sharing the name
+		};
+		std::unordered_map<std::string, NameEntry> named;
+		void pushFields();
+		void popFields();
+		void moveFields(int from, int to);
+
+	public:
+		std::vector<glm::vec3> position;
+		std::vector<glm::vec3> velocity;
+		std::vector<glm::vec3> correction;
+		std::vector<glm::vec3> direction;
+		std::vector<glm::vec3> shape;
+		std::vector<glm::vec3> color;
+		std::vector<float> radius;
+		std::vector<float> mass;
+		std::vector<float> charge;
+		std::vector<float> age;
+		std::vector<int> geometry;
+		std::vector<unsigned char> collisions;
+		std::vector<unsigned char> physics;
+		// Cold data
+		std::vector<std::string> name;
+		std::vector<Object3D*> owner; // object added through Scene::add, or null
+		std::vector<int> id; // handle id
+		// Indices whose object changed in the last add() or erase(), the new
+		// or emptied one included
+		int moved[GEOMETRY_TYPES + 1];
+		int movedCount;
+
+		ObjectStore();
+		int size();
+		int groupBegin(int geometry);
+		int groupEnd(int geometry);
+		// Inserts at the end of the object's geometry group and returns its index
+		int add(const Object3D &desc, Object3D *owner);
+		void erase(int index);
+		// Index of the first object added under name, -1 if none is left
+		int find(const std::string &name);
+		ObjectHandle handle(int index);
+		// -1 once the object is gone
+		int indexOf(ObjectHandle handle);
+		void read(int index, Object3D &out);
+		void write(int index, const Object3D &desc);
+		// The handle tables, saved with a snapshot so handles taken before
+		// a save still find their objects after the load
+		const std::vector<unsigned int>& generations();
+		const std::vector<int>& freeHandles();
+		// Called once every public field has been filled in for the same
+		// number of objects, already grouped by geometry. Rebuilds the
+		// lookups from them and lets go of every owner.
+		void restore(const int* groupStart, const unsigned int* generations, int idCount, const int* freeIds, int freeCount);
+		// Copies the groups and the fields the renderers read. The rest,
+		// names and handles included, are left as they were.
+		void copyDrawn(const ObjectStore &from);
+	};
+
 	class Scene
 	{
-		float map(glm::vec3, int exclude);
 		float sdSphere(glm::vec3 p, float s);
 		float sdTorus(glm::vec3 p, glm::vec2 t);
 		float sdRoundBox(glm::vec3 p, glm::vec3 b, float r);
 		float sdBoxInterior(glm::vec3 p, glm::vec3 b);
-		glm::vec3 normal(glm::vec3 p, int exclude);
+		// Scratch for batched collision queries in update()
+		std::vector<float> packetX, packetY, packetZ, packetDist;
+		std::vector<int> packetExclude;
+		BroadPhase *broadPhase;
+		// Per worker, so collision queries can run side by side
+		struct StepScratch
+		{
+			std::vector<int> candidates;
+			BroadPhase::QueryStamps stamps;
+		};
+		std::vector<StepScratch> scratch;
+		void refreshBounds(int index);
+		// Sphere charge interaction, evaluated from start-of-step positions
+		BarnesHut *barnesHut;
+		std::vector<glm::vec3> chargeForces;
+		glm::vec3 exactChargeForce(int index);
+		void buildChargeTree();
+		void computeChargeForces();
+		// update() reads state N from objects and writes state N+1 here, so
+		// no object ever sees another one half way through the step
+		std::vector<glm::vec3> nextPosition, nextVelocity;
+		// Positions before the last update(), for drawing between steps.
+		// Emptied whenever objects are added or removed.
+		std::vector<glm::vec3> previousPosition;
+		void stepCamera(int index);
+		void stepObject(int index, int worker);
+		void integrate(int index, glm::vec3 position, glm::vec3 velocity);
+		// Runs fn over [0, count) in blocks on the pool, or inline without one
+		void parallelRange(int count, std::function<void(int begin, int end, int worker)> fn);
+		// Spheres launched during update() are added once the step is done
+		std::vector<Object3D> pendingSpawns;
+		bool updating;
+		void spawnFrom(int index);
+		// Adds a launched sphere and pairs it up while launchWarps allows
+		void launch(const Object3D &sphere);
+		ObjectHandle unpairedLaunch; // id -1 when there is none
+		// Rebuilds warpLinks, dropping pairs with an end that is gone
+		void refreshWarps();
+		void addObject(const Object3D &desc, Object3D *owner);
+		void removeAt(int index);
+		void mapStatic(const PointPacket &points, float* dist);
+		float staticDistance(glm::vec3 p);
 		
 	public:
-		std::vector<Object3D*> children;
+		ObjectStore objects;
+		// Collision queries only look at objects near the query point
+		bool useBroadPhase;
+		// Not owned. Set to spread each step over several threads; results
+		// are the same for any pool size.
+		ThreadPool *pool;
+		// Fixed geometry fused into one field, tested at every point by
+		// map() and the renderers. Not owned; set before the renderer is
+		// made, since its GLSL is compiled into march.frag.
+		const StaticSdf *staticGeometry;
+		// Not owned. When set, static distances come from this bake of
+		// staticGeometry instead; normals still come from the tree.
+		const BrickMap *staticBake;
+		// Linked warps. Launched spheres are linked two by two, with
+		// warpInfluence, until there are launchWarps pairs.
+		std::vector<WarpPair> warps;
+		int launchWarps;
+		float warpInfluence;
+		// warps by index, kept up to date as objects come and go
+		std::vector<WarpLink> warpLinks;
+		void linkWarps(ObjectHandle a, ObjectHandle b, float influence);
+		// How far past the previous step to draw, 1 being the latest state
+		float renderAlpha;
+		// Angles the view is drawn along; update() takes them from the controls
+		glm::vec2 viewRotation;
+		glm::vec3 renderPosition(int index);
+		ForceSolver forceSolver;
+		float theta; // Barnes-Hut opening angle
+		ForceStats forceStats;
 		//Controls control;
 		Scene();
+		~Scene();
+		// add copies obj into the store; its fields are then only a snapshot.
+		// sync refreshes them from the live state and commit writes edits back.
 		void add(Object3D *obj);
+		// Adds a copy of desc that no Object3D follows, such as a launched
+		// sphere. Not during update().
+		ObjectHandle place(const Object3D &desc);
 		void remove(std::string name);
+		// False if the object was already gone
+		bool remove(ObjectHandle handle);
+		void sync(Object3D *obj);
+		void commit(Object3D *obj);
+		// Makes obj follow the object with its name again, as after a
+		// loadSnapshot(). False if there is none.
+		bool attach(Object3D *obj);
+		// Writes every object with its physics state, and the view angles
+		// the cameras steer by, to a file loadSnapshot() maps back in.
+		// tick is kept for the caller to resume its clock from.
+		bool saveSnapshot(const char* filename, long long tick);
+		// Replaces every object. Not during update(); the scene is left as
+		// it was if the file is not valid.
+		bool loadSnapshot(const char* filename, long long &tick);
 		void spawn(Camera *camera);
 		glm::vec2 rot2D(glm::vec2 p, float angle);
 		void update();
+		// Makes to a scene the renderers can draw in place of this one:
+		// the drawn fields of every object, the positions before the last
+		// step, the view angles, the warp links, the static geometry and the
+		// force statistics. Nothing else in to is meant to be used.
+		void copyDrawState(Scene *to);
+		// Compares the Barnes-Hut field against the exact sum for every
+		// sphere and stores the relative error in forceStats. O(n^2).
+		void measureForceError();
+		// Distance from p to the nearest object other than exclude (-1 for
+		// none), one object at a time without the SIMD kernels
+		float map(glm::vec3, int exclude);
+		// A subset limits both to the listed objects, e.g. broad phase
+		// candidates; a negative subsetCount means every object
+		float map(glm::vec3 p, int exclude, const int* subset, int subsetCount);
+		glm::vec3 normal(glm::vec3 p, int exclude, const int* subset = nullptr, int subsetCount = -1);
+		// map() for a whole packet of points using the selected SIMD kernels
+		void mapPacket(const PointPacket &points, float* dist, const int* subset = nullptr, int subsetCount = -1);
 	};
 
-	class RaymarchRenderer
-	{
-		std::string loadSource(char* filename);
-		/*const*/ GLuint width, height;
-		GLuint VBO, VAO, EBO;
-		GLuint shaderProgram;
-		GLuint timeLocation, resolutionLocation, rotationLocation, camPosLocation, objCountLocation, warpALoc, warpBLoc, warpCountLoc;
-		shaderObject3D *objectLocations;
-		void updateUniforms(Scene* scene, Camera* camera);
-		
-	public:
-		RaymarchRenderer(int w, int h);
-		~RaymarchRenderer();
-		GLFWwindow* window;
-		void resize(int x, int y);
-		void render(Scene* scene, Camera* camera);
-	};
-
-	void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
-
-	void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
-
-	static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos);
-
 }
\ No newline at end of file
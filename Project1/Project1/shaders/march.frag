@@ -1,6 +1,4 @@
-#version 420 core
-
-#define MAX_OBJECTS 20
+#version 430 core
 
 //// Structs ////
 
@@ -16,17 +14,18 @@ struct Material
 
 // Perhaps a version of this with texture support?
 
+// std430 mirror of rme::GpuObject, four vec4s per object
 struct Object3D
 {
 	vec3 position;
-	vec3 direction;
-	//mat4 translation;
 	float radius;
+	vec3 direction;
 	float age;
+	//mat4 translation;
 	vec3 shape;
 	int geometry; 
-	float mass;
 	vec3 color;
+	float mass;
 //	Material material;
 };
 
@@ -88,81 +87,271 @@ vec2 rot2D(vec2 p, float angle)
     return p * mat2(c,s,-s,c);
 }
 
+vec3 rotateY(vec3 p, float angle)
+{
+	p.xz = rot2D(p.xz, angle);
+	return p;
+}
+
 float norm(float n)
 {
 	return 0.5*n+0.5;
 }
 
+/// Static Geometry ///
+
+// Replaced by rme::StaticSdf::glsl when the scene has static geometry.
+// closestIndex is -1 where it is nearest. staticMap() is what the march
+// reads, either staticExact() itself or a bake of it (rme::BrickMap).
+//#static
+const vec3 staticColor = vec3(0.0);
+float staticExact(vec3 p)
+{
+	return 1000000.0;
+}
+float staticMap(vec3 p)
+{
+	return staticExact(p);
+}
+//#endstatic
+
 /// Ray Marching and Distance Fields ///
 
-float map(vec3 p, Object3D obj[MAX_OBJECTS], int objCount, inout int closestIndex)
+////////////
+
+// Scene buffers, see rme::ObjectBuffer
+
+layout(std430, binding = 0) readonly buffer ObjectBlock
+{
+	Object3D objects[];
+};
+
+// Uniform grid over the spheres, see rme::SceneGrid
+layout(std430, binding = 1) readonly buffer GridBlock
+{
+	vec3 gridOrigin;
+	float cellSize;
+	ivec3 gridDims;
+	float gridMargin;
+	int objectsOffset;
+	int globalOffset;
+	int globalCount;
+	int cellCount;
+	// cells (first, count) pairs, then cell objects, then global objects
+	int gridData[];
+};
+
+// Per screen tile, the warps and the grid's global objects its rays can
+// meet while straight, see rme::ScreenTiles
+layout(std430, binding = 3) readonly buffer TileBlock
+{
+	int tileSize;
+	int tilesX;
+	int tilesY;
+	int warpListOffset;
+	int objectListOffset;
+	int globalObjectCount;
+	// Four ints per tile, (first, count) in the warp list and in the
+	// object list, then the warp list, then the object list, which opens
+	// with every global object
+	int tileData[];
+};
+
+// The global objects map() tests, from the object list: the tile's while
+// the ray is straight, all of them once it is bent
+int mapFirst = 0;
+int mapCount = 0;
+
+// What this pixel's march cost: steps of intersect(), objects map()
+// tested and calls to intersect()
+int costSteps = 0;
+int costObjects = 0;
+int costMarches = 0;
+
+void testObject(int i, vec3 p, bool movingOnly, inout float dist, inout int closestIndex)
+{
+	float altDist;
+	if (movingOnly && objects[i].geometry != 4) return;
+	switch(objects[i].geometry) {
+		case 4:
+			altDist = sdSphere( p - objects[i].position, objects[i].radius);
+			if (altDist < dist) {
+				dist = altDist;
+				closestIndex = i;
+			}
+			break;
+		case 7:
+			altDist = sdBoxInterior( p - objects[i].position, objects[i].shape);
+			if (altDist < dist) {
+				dist = altDist;
+				closestIndex = i;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+// movingOnly leaves out the room and the static geometry
+float map(vec3 p, inout int closestIndex, bool movingOnly)
 {
 	float dist = 1000000.0;
-	for (int i = 0; i < MAX_OBJECTS; i++) {
-		if (i>=objCount) break;
-		if (obj[i].geometry == 1) continue;
-		float altDist;
-		switch(obj[i].geometry) {
-			case 4:
-				altDist = sdSphere( p - obj[i].position, obj[i].radius);
-				if (altDist < dist) {
-					dist = altDist;
-					closestIndex = i;
-				}
-				break;
-			case 7:
-				altDist = sdBoxInterior( p - obj[i].position, obj[i].shape);
-				if (altDist < dist) {
-					dist = altDist;
-					closestIndex = i;
-				}
-				//dist = min(dist, sdSphere( p + obj[i].position, 4.0 ));
-				break;
-			default:
-				dist = min(dist, 1000000.0);
-				break;
+	float staticDist = movingOnly ? dist : staticMap(p);
+	if (staticDist < dist) {
+		dist = staticDist;
+		closestIndex = -1;
+	}
+	for (int n = 0; n < mapCount; n++) {
+		testObject(tileData[objectListOffset + mapFirst + n], p, movingOnly, dist, closestIndex);
+	}
+	costObjects += mapCount;
+	if (cellCount == 0) return dist;
+
+	vec3 local = (p - gridOrigin) / cellSize;
+	ivec3 cell = ivec3(floor(local));
+	if (all(greaterThanEqual(cell, ivec3(0))) && all(lessThan(cell, gridDims))) {
+		int index = 2*(cell.x + gridDims.x*(cell.y + gridDims.y*cell.z));
+		int first = gridData[index];
+		int count = gridData[index + 1];
+		for (int n = 0; n < count; n++) {
+			testObject(gridData[objectsOffset + first + n], p, movingOnly, dist, closestIndex);
 		}
+		costObjects += count;
+		// Anything not listed is at least this far, and empty cells know
+		// how many more empty cells surround them
+		vec3 f = local - vec3(cell);
+		vec3 toEdge = min(f, 1.0 - f);
+		float skip = count == 0 ? float(first - 1) : 0.0;
+		dist = min(dist, (min(toEdge.x, min(toEdge.y, toEdge.z)) + skip)*cellSize + gridMargin);
+	} else {
+		vec3 gridEnd = gridOrigin + vec3(gridDims)*cellSize;
+		vec3 outside = max(max(gridOrigin - p, p - gridEnd), 0.0);
+		dist = min(dist, length(outside) + gridMargin);
 	}
 	return dist;
 }
 
-void intersect(inout Ray r, Object3D obj[MAX_OBJECTS], int objCount, inout int closestIndex, vec3 warpA, vec3 warpB, int warpCount)
+float map(vec3 p, inout int closestIndex)
+{
+	return map(p, closestIndex, false);
+}
+
+// Linked warps, see rme::ScreenTiles
+struct Warp
+{
+	vec3 a;
+	int indexA;
+	vec3 b;
+	int indexB;
+	float influence;
+};
+
+layout(std430, binding = 2) readonly buffer WarpBlock
+{
+	int warpCount;
+	Warp warps[];
+};
+
+// Index into tileData of the tile holding pixel
+int tileAt(vec2 pixel)
+{
+	ivec2 tile = min(ivec2(pixel) / tileSize, ivec2(tilesX, tilesY) - 1);
+	return 4*(tile.x + tilesX*tile.y);
+}
+
+// Pull on a ray at p from one warp end, faded out to none at the edge of
+// its influence so rays do not kink crossing it
+vec3 warpPull(vec3 p, vec3 end, float influence)
+{
+	vec3 diff = p - end;
+	float len = length(diff);
+	if (len >= influence) return vec3(0.0);
+	float fade = 1.0 - len*len / (influence*influence);
+	return 1.2 * fade*fade / pow(len, 3.0) * diff;
+}
+
+// totalD is how far the ray has already come. True when the ray reached a
+// surface. Until it is bent the ray is straight and only the warps and
+// objects listed for its tile, at tile in tileData, can reach it; after
+// that any can.
+bool intersect(inout Ray r, inout int closestIndex, int tile, bool bent, float totalD)
 {
     const float maxDist = 280.0;
     const float epsilon = 0.005;
-    float totalD = 0.0;
+	costMarches++;
 	for (int i=0; i < 96; i++)
     {
-		float minDist = map(r.position, obj, objCount, closestIndex);
-
-		// Warping from warpA and warpB
-		if (warpCount > 1) {
-			vec3 diffA = r.position - warpA;
-			vec3 diffB = r.position - warpB;
-			float diffALength = length(diffA);
-			float diffBLength = length(diffB);
-			minDist =  min(minDist, min(diffALength, diffBLength));
-			float forceA = 1.2 / (pow(diffALength,3.0));
-			float forceB = 1.2 / (pow(diffBLength,3.0));
-			r.direction = normalize(r.direction - minDist * (forceA * diffA + forceB * diffB));
+		costSteps++;
+		// Bent towards the warps the ray is within reach of
+		int count = bent ? warpCount : tileData[tile + 1];
+		vec3 pull = vec3(0.0);
+		for (int n = 0; n < count; n++) {
+			Warp w = warps[bent ? n : tileData[warpListOffset + tileData[tile] + n]];
+			pull += warpPull(r.position, w.a, w.influence) + warpPull(r.position, w.b, w.influence);
+		}
+		// A bent ray can leave its tile's cone, this step's included, so it
+		// tests everything
+		if (pull != vec3(0.0)) bent = true;
+		if (bent) {
+			mapFirst = 0;
+			mapCount = globalObjectCount;
 		}
+		float minDist = map(r.position, closestIndex);
+		if (pull != vec3(0.0)) r.direction = normalize(r.direction - minDist * pull);
 
    		r.position += r.direction * minDist * 0.65;
 
         totalD += minDist;
-        if (minDist < epsilon || totalD > maxDist) break;
+        if (minDist < epsilon) return true;
+        if (totalD > maxDist) break;
     }
+	return false;
+}
 
+// How far every ray through a tile can go without meeting anything. The
+// cone around r holds all of them, spread wide per unit of distance, and
+// each step only goes as far as the empty sphere at the sample still
+// covers the cone's cross-section.
+float coneMarch(Ray r, float spread)
+{
+	const float maxDist = 280.0;
+	float t = 0.0;
+	int dummy;
+	for (int i = 0; i < 64; i++)
+	{
+		float d = map(r.position + r.direction * t, dummy);
+		float stepD = (d - spread * t) / (1.0 + spread);
+		if (stepD < 0.01) break;
+		t += stepD;
+		if (t > maxDist) break;
+	}
+	return t;
 }
 
-vec3 calcNormal(vec3 p, Object3D obj[MAX_OBJECTS], int objCount, inout int closestIndex)
+// Straight out of the nearest face inside the box, towards p outside it
+vec3 boxGradient(vec3 p, vec3 b)
 {
-    vec3 eps = vec3(0.002,0.0,0.0);
+	vec3 d = abs(p) - b;
+	vec3 s = sign(p);
+	if (max(d.x, max(d.y, d.z)) > 0.0) return s * normalize(max(d, 0.0));
+	if (d.x > d.y && d.x > d.z) return vec3(s.x, 0.0, 0.0);
+	return d.y > d.z ? vec3(0.0, s.y, 0.0) : vec3(0.0, 0.0, s.z);
+}
 
-	return normalize(vec3(
-           map(p+eps.xyy, obj, objCount, closestIndex) - map(p-eps.xyy, obj, objCount, closestIndex),
-           map(p+eps.yxy, obj, objCount, closestIndex) - map(p-eps.yxy, obj, objCount, closestIndex),
-           map(p+eps.yyx, obj, objCount, closestIndex) - map(p-eps.yyx, obj, objCount, closestIndex)));
+// Of the object at closestIndex, from its own gradient rather than taps of
+// the whole map(). The static geometry can be any composite, so it takes
+// four taps of staticExact() at the corners of a tetrahedron; a bake would
+// show its voxels in the shading.
+vec3 calcNormal(vec3 p, int closestIndex)
+{
+	if (closestIndex < 0) {
+		const vec2 k = vec2(1.0, -1.0);
+		const float eps = 0.002;
+		return normalize(k.xyy*staticExact(p + k.xyy*eps) + k.yyx*staticExact(p + k.yyx*eps) +
+			k.yxy*staticExact(p + k.yxy*eps) + k.xxx*staticExact(p + k.xxx*eps));
+	}
+	if (objects[closestIndex].geometry == 4) return normalize(p - objects[closestIndex].position);
+	return -boxGradient(p - objects[closestIndex].position, objects[closestIndex].shape);
 }
 
 ////////////
@@ -176,13 +365,131 @@ uniform vec2 resolution;
 uniform vec2 cameraRotation;
 uniform vec3 cameraPos;
 
-uniform int warpCount;
-uniform vec3 warpA;
-uniform vec3 warpB;
 
-uniform int objectCount;
+// Rays start at the distance the coarse pass found for their tile of
+// coneTile x coneTile pixels, or at the camera when coneTile is 0
+uniform bool conePrepass; // true while drawing that coarse pass
+uniform int coneTile;
+uniform sampler2D coneDepth;
+
+// Last frame's first hits, see RaymarchRenderer::enableReprojection
+uniform bool historyValid;
+uniform bool writeHistory;
+uniform int frameIndex;
+uniform vec3 prevCameraPos;
+uniform vec2 prevCameraRotation;
+uniform vec2 prevResolution;
+uniform sampler2D historyIn; // distance along the ray, index of what it hit
+layout(rg32f, binding = 0) uniform writeonly image2D historyOut;
+
+// Unless STATS_OFF, what each pixel is tinted by, and the buffer its cost is added
+// into; see rme::RenderStats for both. The STATS_ constants are defined
+// from RenderStats.h when the renderer loads this file.
+uniform int statsMode;
+layout(std430, binding = 4) buffer StatsBlock
+{
+	uint statsPixels;
+	uint statsSteps[2]; // low and high words
+	uint statsObjects[2];
+	uint statsMarches[2];
+	uint stepHistogram[STATS_BINS];
+	uint objectHistogram[STATS_BINS];
+	uint marchHistogram[STATS_MARCHES_MAX + 1];
+};
+
+// Blue through green to red over [0, 1]
+vec3 heat(float t)
+{
+	t = clamp(t, 0.0, 1.0);
+	return clamp(vec3(1.5 - abs(4.0*t - 3.0), 1.5 - abs(4.0*t - 2.0), 1.5 - abs(4.0*t - 1.0)), 0.0, 1.0);
+}
+
+float statsHeat()
+{
+	if (statsMode == STATS_STEPS) return float(costSteps) / 96.0;
+	if (statsMode == STATS_MARCHES) return float(costMarches - 1) / float(STATS_MARCHES_MAX - 1);
+	return log2(float(costObjects) + 1.0) / 12.0;
+}
+
+void recordCost()
+{
+	atomicAdd(statsPixels, 1u);
+	// Totals outgrow 32 bits, so a wrapped low word carries into the high one
+	uint low = atomicAdd(statsSteps[0], uint(costSteps));
+	if (low + uint(costSteps) < low) atomicAdd(statsSteps[1], 1u);
+	low = atomicAdd(statsObjects[0], uint(costObjects));
+	if (low + uint(costObjects) < low) atomicAdd(statsObjects[1], 1u);
+	low = atomicAdd(statsMarches[0], uint(costMarches));
+	if (low + uint(costMarches) < low) atomicAdd(statsMarches[1], 1u);
+	atomicAdd(stepHistogram[min(costSteps / STATS_STEP_BIN, STATS_BINS - 1)], 1u);
+	atomicAdd(objectHistogram[min(findMSB(costObjects + 1), STATS_BINS - 1)], 1u);
+	atomicAdd(marchHistogram[min(costMarches, STATS_MARCHES_MAX)], 1u);
+}
+
+vec3 rayDirection(vec2 pixel, vec2 res, vec2 rotation)
+{
+	vec2 uv = (pixel / res) * 2.0 - 1.0;
+    uv.x *= res.x / res.y; 
+
+	vec3 direction = normalize(vec3(uv, 1.2));
+	
+	direction.yz = rot2D( direction.yz, rotation.y); 
+	direction.xz = rot2D( direction.xz, rotation.x); 
+	return direction;
+}
+
+// Last frame's history texel that p was seen through, or -1s when p was off
+// screen or behind the camera
+ivec2 previousTexel(vec3 p)
+{
+	vec3 d = p - prevCameraPos;
+	d.xz = rot2D(d.xz, -prevCameraRotation.x);
+	d.yz = rot2D(d.yz, -prevCameraRotation.y);
+	if (d.z <= 0.0) return ivec2(-1);
+	vec2 uv = d.xy * 1.2 / d.z;
+	uv.x *= prevResolution.y / prevResolution.x;
+	vec2 pixel = (uv + 1.0) * 0.5 * prevResolution;
+	if (any(lessThan(pixel, vec2(0.0))) || any(greaterThanEqual(pixel, prevResolution))) return ivec2(-1);
+	return ivec2(pixel);
+}
+
+// How far along dir the surface seen through this pixel last frame is, or
+// -1 when there was none. Starting from this pixel's old distance, the
+// point on the new ray is moved to wherever the old ray through it hit, so
+// after a couple of rounds it sits on a remembered surface.
+float reproject(vec3 dir, vec2 pixel, out int index)
+{
+	ivec2 texel = ivec2(pixel * prevResolution / resolution);
+	vec2 hit = texelFetch(historyIn, texel, 0).rg;
+	float t = hit.x;
+	for (int i = 0; i < 2; i++) {
+		if (t <= 0.0) return -1.0;
+		texel = previousTexel(cameraPos + dir * t);
+		if (texel.x < 0) return -1.0;
+		hit = texelFetch(historyIn, texel, 0).rg;
+		if (hit.x <= 0.0) return -1.0;
+		vec3 remembered = prevCameraPos + rayDirection(vec2(texel) + 0.5, prevResolution, prevCameraRotation) * hit.x;
+		t = dot(remembered - cameraPos, dir);
+	}
+	index = int(hit.y);
+	return t;
+}
+
+// Whether a sphere, which may have moved since last frame, now lies on the
+// ray between from and to
+bool movingBlocks(vec3 dir, float from, float to)
+{
+	int dummy;
+	float t = from;
+	for (int i = 0; i < 32; i++) {
+		float d = map(cameraPos + dir * t, dummy, true);
+		if (d < 0.005) return true;
+		t += d;
+		if (t >= to) return false;
+	}
+	return true;
+}
 
-uniform Object3D objects[MAX_OBJECTS];
 
 /////////
 
@@ -190,51 +497,101 @@ void main()
 {
 	vec3 eyePos = vec3(0.0, 0.0, 0.0); // Could be set to something else
 	
-	vec2 uv = (gl_FragCoord.xy / resolution) * 2.0 - 1.0;
-    uv.x *= resolution.x / resolution.y; 
+	// The coarse pass draws a pixel per tile and marches the tile's centre
+	vec2 pixel = conePrepass ? gl_FragCoord.xy * float(coneTile) : gl_FragCoord.xy;
+	Ray ray = Ray(cameraPos, rayDirection(pixel, resolution, cameraRotation));
+	int tile = tileAt(pixel);
+	int listCount = tileData[tile + 1]; // warps
+	mapFirst = tileData[tile + 2];
+	mapCount = tileData[tile + 3];
+
+	if (conePrepass) {
+		// Half the tile's diagonal, in uv units, over the image plane distance.
+		// Screen tiles are whole cone tiles, so where warps may bend the rays
+		// they all start at the camera.
+		float spread = 1.4143 * float(coneTile) / resolution.y / 1.2;
+		color = vec4(listCount > 0 ? 0.0 : coneMarch(ray, spread), 0.0, 0.0, 1.0);
+		return;
+	}
+	float start = 0.0;
+	if (coneTile > 0) {
+		start = texelFetch(coneDepth, ivec2(gl_FragCoord.xy) / coneTile, 0).r;
+		ray.position += ray.direction * start;
+	}
 
-	Ray ray = Ray(cameraPos, normalize(vec3(uv, 1.2)));
-	
-	ray.direction.yz = rot2D( ray.direction.yz, cameraRotation.y); 
-	ray.direction.xz = rot2D( ray.direction.xz, cameraRotation.x); 
+	// A quarter of the pixels march in full each frame, in turn, so a
+	// wrongly reused hit lasts no more than four frames
+	int turn = (int(pixel.x) & 1) | ((int(pixel.y) & 1) << 1);
+	if (historyValid && listCount == 0 && turn != (frameIndex & 3)) {
+		int remembered = -2;
+		float t = reproject(ray.direction, pixel, remembered);
+		// Only the room and the static geometry hold still
+		bool still = remembered == -1 || (remembered >= 0 && objects[remembered].geometry == 7);
+		if (t > start && still) {
+			const float tolerance = 0.02;
+			int index = -2;
+			float d = map(cameraPos + ray.direction * t, index);
+			// At a glancing angle the remembered point can be some way along
+			// the ray from the surface, so the march resumes only from in
+			// front of it
+			float resume = t - 2.0 * tolerance;
+			if (abs(d) < tolerance && index == remembered && map(cameraPos + ray.direction * resume, index) > tolerance
+				&& !movingBlocks(ray.direction, start, resume)) {
+				start = resume;
+				ray.position = cameraPos + ray.direction * start;
+			}
+		}
+	}
 
 	//vec3 spherePos = objects[0].position;//vec3(0.0, 0.0, 4.0);
 
 	int closestIndex;
-	int dummy;
 	vec3 normal;
 	Object3D closest;
 	
-	intersect(ray, objects, objectCount, closestIndex, warpA, warpB, warpCount);
+	bool hit = intersect(ray, closestIndex, tile, false, start);
+	if (writeHistory) {
+		// Rays warps may have bent are not straight, so they are not kept
+		float t = hit && listCount == 0 ? length(ray.position - cameraPos) : -1.0;
+		imageStore(historyOut, ivec2(pixel), vec4(t, float(closestIndex), 0.0, 0.0));
+	}
 
 	for (int timesWarped = 0; timesWarped < 2; timesWarped++) {
 
+		if (closestIndex < 0) break;
 		closest = objects[closestIndex];
 
 		if (closest.geometry == 4) {
 			/*
-			normal = calcNormal(ray.position, objects, objectCount, dummy);
+			normal = calcNormal(ray.position, closestIndex);
 			ray.direction = reflect(ray.direction, normal);
 			ray.position += ray.direction * 0.2;
 			*/
-			if (length(closest.position - warpA) - closest.radius < 0.05) {
-				ray.position -= warpA;
-			//	ray.position.y *= -1.0;
-				ray.position += warpB;
-			} else if (length(closest.position - warpB) - closest.radius < 0.05) {
-				ray.position -= warpB;
-			//	ray.position.y *= -1.0;
-				ray.position += warpA;
+			// Out of the other end if it is a warp
+			for (int n = 0; n < warpCount; n++) {
+				if (warps[n].indexA == closestIndex) {
+					ray.position += warps[n].b - warps[n].a;
+					break;
+				}
+				if (warps[n].indexB == closestIndex) {
+					ray.position += warps[n].a - warps[n].b;
+					break;
+				}
 			}
 			ray.direction = -ray.direction;
 			ray.position += ray.direction * 0.2;
-			intersect(ray, objects, objectCount, closestIndex, warpA, warpB, warpCount);
+			intersect(ray, closestIndex, tile, true, 0.0);
 		}
 
 	}
 
-	closest = objects[closestIndex];
-	vec3 color1 = closest.color;
+	vec3 color1 = staticColor;
+	if (closestIndex < 0) {
+		closest.geometry = -1;
+	} else {
+		closest = objects[closestIndex];
+		color1 = closest.color;
+	}
 	if (closest.geometry == 4) {
 		color1.r = sin(closest.age*0.04)*0.5 + 0.5;
 	} else if (closest.geometry == 7) {
@@ -250,11 +607,15 @@ void main()
 	//ray.position += d * ray.direction;
 
 
-	normal = calcNormal(ray.position, objects, objectCount, dummy);
+	normal = calcNormal(ray.position, closestIndex);
 
 	ray.direction = reflect(ray.direction, normal);
 	
 	color = vec4(color1*(dot(normal, ray.direction)+0.2), 1.0); 
+	if (statsMode != STATS_OFF) {
+		color.rgb = mix(color.rgb, heat(statsHeat()), 0.7);
+		recordCost();
+	}
 
 //	color = vec4(sin(20.0*gl_FragCoord.x/resolution.x)*0.5+0.5, 0.8, 0.0, 1.0);
 }
\ No newline at end of file